@@ -14,7 +14,24 @@
 
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <iio.h>
+#include "rxblock.h"
+#include "lockfreequeue.h"
+
+// TCP port iiod listens on, probed before reconnecting
+#define IIOD_PORT "30431"
 
 using namespace std;
 class AD9361 {
@@ -71,7 +88,7 @@ public:
      * @return true Value read
      * @return false Error while reading value
      */
-    bool readAttribute(const iio_channel *chan, const char* what, long long &val)
+    bool readAttribute(const iio_channel *chan, const char* what, long long &val) const
     {
         if(iio_channel_attr_read_longlong(chan, what, &val) < 0) {
             return false;
@@ -90,7 +107,7 @@ public:
      * @return true Value read
      * @return false Error while reading value
      */
-    bool readAttribute(const iio_channel *chn, const char* what, char* str, ssize_t maxLen)
+    bool readAttribute(const iio_channel *chn, const char* what, char* str, ssize_t maxLen) const
     {
         if(iio_channel_attr_read(chn, what, str, maxLen) < 0) {
             return false;
@@ -100,13 +117,67 @@ public:
         }
     }
 
+    /**
+     * @brief Writes attribute of every chain's phy channel
+     * 
+     * @param what Attribute name
+     * @param val Value to write
+     * @return true Value was written to every chain
+     * @return false At least one chain wasn't written
+     */
+    bool writeChainAttribute(const char* what, long long val)
+    {
+        bool ret = true;
+        for(size_t i = 0; i < phyChans.size(); i++) {
+            ret = writeAttribute(phyChans[i], what, val) && ret;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Writes attribute of every chain's phy channel
+     * 
+     * @param what Attribute name
+     * @param str Value to write
+     * @return true Value was written to every chain
+     * @return false At least one chain wasn't written
+     */
+    bool writeChainAttribute(const char* what, const char* str)
+    {
+        bool ret = true;
+        for(size_t i = 0; i < phyChans.size(); i++) {
+            ret = writeAttribute(phyChans[i], what, str) && ret;
+        }
+        return ret;
+    }
+
     public:
+    /**
+     * @brief Last configuration successfully written through setters
+     */
+    struct Config {
+        string rfPort;          // Empty when never set
+        long long bandwidthHz;  // 0 when never set
+        long long samplingRate; // 0 when never set
+        long long loHz;         // 0 when never set
+        string gainControlMode; // Empty when never set
+        long long hardwareGain; // Gain in dB, valid when hasHardwareGain
+        bool hasHardwareGain;
+
+        Config() :
+            bandwidthHz(0),
+            samplingRate(0),
+            loHz(0),
+            hardwareGain(0),
+            hasHardwareGain(false) {}
+    };
+
     /**
      * @brief Get current RF port
      * 
      * @return string RF Port
      */
-    string getRFPort()
+    string getRFPort() const
     {
         char buf[256] = "";
 
@@ -123,7 +194,11 @@ public:
      */
     bool setRFPort(string &rfPort)
     {
-        return writeAttribute(phyChan, "rf_port_select", rfPort.c_str());
+        bool ret = writeAttribute(phyChan, "rf_port_select", rfPort.c_str());
+        if(ret) {
+            config.rfPort = rfPort;
+        }
+        return ret;
     }
 
     /**
@@ -131,7 +206,7 @@ public:
      * 
      * @return long long Analog bandwidth in HZ
      */
-    long long getBandwidthHz()
+    long long getBandwidthHz() const
     {
         long long val = 0;
         
@@ -148,7 +223,11 @@ public:
      */
     bool setBandwidthHz(long long val)
     {
-        return writeAttribute(phyChan, "rf_bandwidth", val);
+        bool ret = writeAttribute(phyChan, "rf_bandwidth", val);
+        if(ret) {
+            config.bandwidthHz = val;
+        }
+        return ret;
     }
 
     /**
@@ -156,7 +235,7 @@ public:
      * 
      * @return long long Baseband sample rate in HZ
      */
-    long long getSamplingRate()
+    long long getSamplingRate() const
     {
         long long val = 0;
         
@@ -173,7 +252,11 @@ public:
      */
     bool setSamplingRate(long long val)
     {
-        return writeAttribute(phyChan, "sampling_frequency", val);
+        bool ret = writeAttribute(phyChan, "sampling_frequency", val);
+        if(ret) {
+            config.samplingRate = val;
+        }
+        return ret;
     }
 
     /**
@@ -181,9 +264,9 @@ public:
      * 
      * @return long long 
      */
-    long long getLoFrequency()
+    long long getLoFrequency() const
     {
-        long long val;
+        long long val = 0;
         readAttribute(loChan, "frequency", val);
 
         return val;
@@ -198,147 +281,294 @@ public:
      */
     bool setLoFrequency(long long val)
     {
-        return writeAttribute(loChan, "sampling_frequency", val);
+        bool ret = writeAttribute(loChan, "frequency", val);
+        if(ret) {
+            config.loHz = val;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Get current hardware gain of first chain in dB
+     * 
+     * @return long long Gain in dB, negative attenuation for TX
+     */
+    long long getHardwareGain() const
+    {
+        long long val = 0;
+        readAttribute(phyChan, "hardwaregain", val);
+
+        return val;
+    }
+
+    /**
+     * @brief Set hardware gain of every chain in dB
+     * 
+     * RX gain is only writable in manual gain control mode. All chains get
+     * the same gain so antennas stay amplitude matched.
+     *
+     * @param val Gain in dB, negative attenuation for TX
+     * @return true Value was set on every chain
+     * @return false Value wasn't set
+     */
+    bool setHardwareGain(long long val)
+    {
+        bool ret = writeChainAttribute("hardwaregain", val);
+        if(ret) {
+            config.hardwareGain = val;
+            config.hasHardwareGain = true;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Set RX gain control mode of every chain
+     * 
+     * @param mode manual, slow_attack, fast_attack or hybrid
+     * @return true Mode was set on every chain
+     * @return false Mode wasn't set
+     */
+    bool setGainControlMode(const string &mode)
+    {
+        bool ret = writeChainAttribute("gain_control_mode", mode.c_str());
+        if(ret) {
+            config.gainControlMode = mode;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Get last configuration written through setters
+     * 
+     * @return const Config& Configuration
+     */
+    const Config& getConfig() const { return config; }
+
+    /**
+     * @brief Writes last known configuration again, used after reconnect
+     * 
+     * @return true Every stored value was written
+     * @return false At least one value couldn't be written
+     */
+    bool restoreConfig()
+    {
+        bool ret = true;
+
+        // sampling rate first, it limits the allowed bandwidth
+        if(config.samplingRate > 0) {
+            ret = writeAttribute(phyChan, "sampling_frequency", config.samplingRate) && ret;
+        }
+        if(config.bandwidthHz > 0) {
+            ret = writeAttribute(phyChan, "rf_bandwidth", config.bandwidthHz) && ret;
+        }
+        if(config.loHz > 0) {
+            ret = writeAttribute(loChan, "frequency", config.loHz) && ret;
+        }
+        if(!config.rfPort.empty()) {
+            ret = writeAttribute(phyChan, "rf_port_select", config.rfPort.c_str()) && ret;
+        }
+        // mode before gain, manual gain is rejected in AGC modes
+        if(!config.gainControlMode.empty()) {
+            ret = writeChainAttribute("gain_control_mode", config.gainControlMode.c_str()) && ret;
+        }
+        if(config.hasHardwareGain) {
+            ret = writeChainAttribute("hardwaregain", config.hardwareGain) && ret;
+        }
+        return ret;
     }
     
     /**
-     * @brief Enable Streaming channels (I/Q)
+     * @brief Enable Streaming channels (I/Q of every chain)
      * 
      */
     void enableStream()
     {
-        iio_channel_enable(streamChanI);
-        iio_channel_enable(streamChanQ);
+        for(size_t i = 0; i < streamChans.size(); i++) {
+            iio_channel_enable(streamChans[i]);
+        }
     }
 
     /**
-     * @brief Disable Streaming channels (I/Q)
+     * @brief Disable Streaming channels (I/Q of every chain)
      * 
      */
     void disableStream()
     {
-        iio_channel_disable(streamChanI);
-        iio_channel_disable(streamChanQ);
+        for(size_t i = 0; i < streamChans.size(); i++) {
+            iio_channel_disable(streamChans[i]);
+        }
+    }
+
+    /**
+     * @brief Get number of enabled RF chains (antennas)
+     * 
+     * @return unsigned int Chain count
+     */
+    unsigned int getChainCount() const
+    {
+        return streamChans.size() / 2;
     }
 
+    /**
+     * @brief Points channel to iio channels of a new context, keeps configuration
+     * 
+     */
+    void bind(
+        const vector<iio_channel*> &streamChans,
+        const vector<iio_channel*> &phyChans,
+        const iio_channel* loChan
+    )
+    {
+        this->streamChans = streamChans;
+        this->phyChans.assign(phyChans.begin(), phyChans.end());
+        this->phyChan = phyChans.front();
+        this->loChan = loChan;
+    }
+
+    /**
+     * @brief Construct a new Channel object
+     * 
+     * @param streamChans Streaming channels, I and Q for each chain in that order
+     * @param phyChans Phy channel of each chain, first one also holds port, bandwidth and sampling rate
+     * @param loChan Local oscillator channel
+     */
     Channel(
-        iio_channel* streamChanI,
-        iio_channel* streamChanQ,
-        const iio_channel* phyChan,
+        const vector<iio_channel*> &streamChans,
+        const vector<iio_channel*> &phyChans,
         const iio_channel* loChan
     ) :
-        streamChanI(streamChanI),
-        streamChanQ(streamChanQ),
-        phyChan(phyChan),
+        streamChans(streamChans),
+        phyChans(phyChans.begin(), phyChans.end()),
+        phyChan(phyChans.front()),
         loChan(loChan) {}
 
     protected:
-        iio_channel* streamChanI;
-        iio_channel* streamChanQ;
+        vector<iio_channel*> streamChans;
+        vector<const iio_channel*> phyChans;
         const iio_channel* phyChan;
         const iio_channel* loChan;
+        Config config;
     }; // Channel Class
 
+    /**
+     * @brief Configuration change applied by streaming thread between refills
+     */
+    struct Command {
+        enum Type {
+            SET_LO_FREQUENCY,   // value in Hz
+            SET_BANDWIDTH,      // value in Hz
+            SET_SAMPLING_RATE,  // value in Hz
+            SET_HARDWARE_GAIN   // value in dB, RX is switched to manual gain control
+        };
+        enum Target { RX, TX };
+
+        Type type;
+        Target target;
+        long long value;
+        unsigned long long id;  // Caller's tag, returned in result
+
+        Command() :
+            type(SET_LO_FREQUENCY),
+            target(RX),
+            value(0),
+            id(0) {}
+
+        Command(Type type, Target target, long long value, unsigned long long id = 0) :
+            type(type),
+            target(target),
+            value(value),
+            id(id) {}
+    };
+
+    /**
+     * @brief Outcome of a command
+     *
+     * The change is written right before the refill delivering the block
+     * starting at sampleIndex, but that block and the following ones may
+     * have been captured earlier and sit in kernel buffers. The change
+     * lands somewhere between sampleIndex and settledSampleIndex, which is
+     * kernel buffer count plus one blocks later to also cover the block in
+     * transfer. A reconnect in between moves both indexes.
+     */
+    struct CommandResult {
+        Command command;
+        bool ok;                        // Attribute was written
+        unsigned long long sampleIndex; // First RX sample that may show the change
+        unsigned long long blockSequence; // Block starting at sampleIndex
+        unsigned long long settledSampleIndex; // First RX sample surely captured after change
+        unsigned long long settledBlockSequence; // Block starting at settledSampleIndex
+    };
+
+    typedef function<void(const CommandResult&)> CommandCallback;
+
     public:
     /**
      * @brief Initializes with network context
      * 
+     * Calling init again without deinit keeps the Channel objects and
+     * their configuration, only the context is recreated. The previous
+     * context is destroyed only once the new one was set up completely,
+     * on failure Channel objects keep pointing into the previous one.
+     *
+     * With 2 chains voltage0..voltage3 are enabled on both streaming
+     * devices (2R2T), RX buffers then hold I0 Q0 I1 Q1 per sample.
+     *
      * @param address Network address to create libiio context
+     * @param chains Number of RF chains to stream, 1 or 2
      * @return true When initialized
      * @return false When failed to initialize
      */
-    bool init(string address)
+    bool init(string address, unsigned int chains = 1)
     {
-        bool ret = true;
         ready = false;
-
-        // init context
-        ctx = iio_create_network_context(address.c_str());
-        if(nullptr == ctx) {
-            return false;
-        }
-        
-        // get devices
-        devTx = iio_context_find_device(ctx, "cf-ad9361-dds-core-lpc");
-        if(nullptr == devTx) {
+        if(chains < 1 || chains > 2) {
             return false;
         }
-
-        devRx = iio_context_find_device(ctx, "cf-ad9361-lpc");
-        if(nullptr == devRx) {
-            return false;
-        }
-
-        devPhy = iio_context_find_device(ctx, "ad9361-phy");
-        if(nullptr == devPhy) {
-            return false;
+        if(address != this->address) {
+            iiodAddrs.clear();
         }
+        this->address = address;
+        this->chains = chains;
 
-        // get channels
-        streamChanRxI = iio_device_find_channel(devRx, "voltage0", false);
-        if(nullptr == streamChanRxI) {
-            streamChanRxI = iio_device_find_channel(devRx, "altvoltage0", false);
-        }
-        if(nullptr == streamChanRxI) {
-            return false;
-        }
-        streamChanRxQ = iio_device_find_channel(devRx, "voltage1", false);
-        if(nullptr == streamChanRxQ) {
-            streamChanRxI = iio_device_find_channel(devRx, "altvoltage1", false);
-        }
-        if(nullptr == streamChanRxQ) {
-            return false;
-        }
-        streamChanTxI = iio_device_find_channel(devTx, "voltage0", true);
-        if(nullptr == streamChanTxI) {
-            streamChanTxI = iio_device_find_channel(devTx, "altvoltage0", true);
-        }
-        if(nullptr == streamChanTxI) {
-            return false;
-        }
-        streamChanTxQ = iio_device_find_channel(devTx, "voltage1", true);
-        if(nullptr == streamChanTxQ) {
-            streamChanTxQ = iio_device_find_channel(devTx, "altvoltage1", true);
-        }
-        if(nullptr == streamChanTxQ) {
+        // init context, previous one stays in use until the new one is complete
+        iio_context* newCtx = iio_create_network_context(address.c_str());
+        if(nullptr == newCtx) {
             return false;
         }
 
-        loChanRx = iio_device_find_channel(devPhy, "altvoltage0", true);
-        if(nullptr == loChanRx) {
-            return false;
-        }
-        loChanTx = iio_device_find_channel(devPhy, "altvoltage1", true);
-        if(nullptr == loChanTx) {
-            return false;
-        }
-        phyChanRx = iio_device_find_channel(devPhy, "voltage0", false);
-        if(nullptr == phyChanRx) {
-            return false;
-        }
-        phyChanTx = iio_device_find_channel(devPhy, "voltage0", true);
-        if(nullptr == phyChanTx) {
+        Handles handles;
+        if(!findHandles(newCtx, chains, handles)) {
+            iio_context_destroy(newCtx);
             return false;
         }
 
         // Setup TXRX
         if(tx != nullptr) {
-            delete(tx);
-            tx = nullptr;
+            tx->bind(handles.streamChansTx, handles.phyChansTx, handles.loChanTx);
+        }
+        else {
+            tx = new Channel(handles.streamChansTx, handles.phyChansTx, handles.loChanTx);
         }
         if(rx != nullptr) {
-            delete(rx);
-            rx = nullptr;
+            rx->bind(handles.streamChansRx, handles.phyChansRx, handles.loChanRx);
+        }
+        else {
+            rx = new Channel(handles.streamChansRx, handles.phyChansRx, handles.loChanRx);
         }
 
-        rx = new Channel(streamChanRxI, streamChanRxQ, phyChanRx, loChanRx);
-        tx = new Channel(streamChanTxI, streamChanTxQ, phyChanTx, loChanTx);
-        
-        if(nullptr == rx) {
-            return false;
+        // nothing points into the previous context anymore
+        if(nullptr != ctx) {
+            iio_context_destroy(ctx);
         }
-        if(nullptr == tx) {
-            return false;
+        ctx = newCtx;
+        devTx = handles.devTx;
+        devRx = handles.devRx;
+        devPhy = handles.devPhy;
+        applyTimeout();
+
+        // resolved while the device is reachable, reconnects then need no lookup
+        if(iiodAddrs.empty() && !address.empty()) {
+            resolveIiod(address, iiodAddrs);
         }
 
         // everything looks setup here
@@ -372,8 +602,95 @@ public:
         }
         // devices -- nothing to do?
         // deinit context
-        iio_context_destroy(ctx);
-        ctx = nullptr;
+        if(nullptr != ctx) {
+            iio_context_destroy(ctx);
+            ctx = nullptr;
+        }
+    }
+
+    /**
+     * @brief Recreates context and writes last known configuration
+     * 
+     * @return true Context is back and configuration was restored
+     * @return false Device still unreachable or configuration failed
+     */
+    bool reconnect()
+    {
+        // libiio waits seconds for an unreachable host, fail fast instead
+        if(connectTimeoutMs > 0 && !iiodAddrs.empty() && !probeIiod(iiodAddrs, connectTimeoutMs)) {
+            return false;
+        }
+        if(!init(address, chains)) {
+            return false;
+        }
+        return rx->restoreConfig() && tx->restoreConfig();
+    }
+
+    /**
+     * @brief Set timeout for libiio operations, applied on next init
+     * 
+     * Refill errors are only detected after this timeout. By default it is
+     * the duration of one RX buffer plus 200 ms, updated whenever buffer
+     * size or RX sampling rate change.
+     *
+     * @param ms Timeout in milliseconds, 0 to derive it from RX buffer duration
+     */
+    void setTimeoutMs(unsigned int ms)
+    {
+        timeoutMs = ms;
+    }
+
+    /**
+     * @brief Set timeout for reaching iiod before reconnecting
+     * 
+     * Bounds every reconnect attempt while the device is unreachable, the
+     * first init is left to libiio. The address resolved on init is
+     * reused, so no name lookup happens while the link is down.
+     * Together with the refill timeout and the reconnect backoff of at
+     * most 250 ms, a stream resumes about half a second after the device
+     * answers again, plus the time to fetch the context description.
+     *
+     * @param ms Timeout in milliseconds, 0 to leave it to libiio
+     */
+    void setConnectTimeoutMs(unsigned int ms)
+    {
+        connectTimeoutMs = ms;
+    }
+
+    /**
+     * @brief Set RX buffer size, applied on next stream start
+     * 
+     * Smaller buffers lower latency at the cost of more refills.
+     *
+     * @param samples Samples per chain in one refill
+     */
+    void setRxBufferSamples(size_t samples)
+    {
+        rxBufferSamples = samples;
+    }
+
+    /**
+     * @brief Set number of kernel buffers behind RX buffer, applied on next stream start
+     * 
+     * Fewer buffers narrow the window in which a command takes effect, see
+     * CommandResult, more buffers ride out longer stalls of the streaming
+     * thread without overflow.
+     *
+     * @param count Kernel buffer count, at least 1
+     */
+    void setKernelBuffers(unsigned int count)
+    {
+        kernelBuffers = max(count, 1u);
+    }
+
+    /**
+     * @brief Set callback notified when RX stream resumed after connection loss
+     * 
+     * @param callback Called from streaming thread with gap details
+     */
+    void setGapCallback(RxGapCallback callback)
+    {
+        gapCallback = callback;
     }
 
     bool isReady()
@@ -381,51 +698,424 @@ public:
         return ready;
     }
 
+    /**
+     * @brief Queues configuration change, safe from any thread
+     * 
+     * While streaming, commands are applied by the streaming thread between
+     * refills, so callers never wait for a network round trip and Channel
+     * state is only touched by one thread. Commands queued while not
+     * streaming are applied when streaming starts.
+     *
+     * @param command Change to apply
+     * @return true Command was queued
+     * @return false Queue is full
+     */
+    bool submitCommand(const Command &command)
+    {
+        return commands.push(command);
+    }
+
+    /**
+     * @brief Set callback receiving command results
+     * 
+     * @param callback Called from streaming thread after each command
+     */
+    void setCommandCallback(CommandCallback callback)
+    {
+        commandCallback = callback;
+    }
+
     /**
      * @brief Starts RX Streaming
      * 
+     * Every refill is copied once into a pooled RxBlock which is passed to
+     * callback. Consumers may keep the block after callback returns.
+     *
      * @param freqHz Initial frequency to tune to
+     * @param callback Called from streaming thread for every received block
      * @return false When staring stream failed
      * @return true Method will not return untill stop stream is called
      */
-    bool startRxStream(long long freqHz)
+    bool startRxStream(long long freqHz, RxCallback callback = RxCallback())
     {
-        if(ready) {
-            // set frequency?
-            
-            // enable rx channels
-            rx->enableStream();
-            // create buffer
-            // todo move bufer size to parameter
+        if(!ready) {
+            return false;
+        }
 
-            iio_buffer* rxBuf = iio_device_create_buffer(devRx, 1024*1024, false);
-            if(nullptr == rxBuf) {
-                // failed to create buffer
-                return false;
-            } 
+        if(freqHz > 0 && !rx->setLoFrequency(freqHz)) {
+            return false;
+        }
+
+        // enable rx channels
+        rx->enableStream();
+        // create buffer
+
+        iio_device_set_kernel_buffers_count(devRx, kernelBuffers);
+        iio_buffer* rxBuf = iio_device_create_buffer(devRx, rxBufferSamples, false);
+        if(nullptr == rxBuf) {
+            // failed to create buffer
+            rx->disableStream();
+            return false;
+        } 
+        applyTimeout();
+
+        // blocks are recycled once all consumers released them
+        shared_ptr<RxBlockPool> pool = RxBlockPool::create(16);
+        unsigned long long sequence = 0;
+        unsigned long long sampleIndex = 0;
+        chrono::steady_clock::time_point lastRefill = chrono::steady_clock::now();
+
+        // start streaming
+        streamingRx = true;
+
+        while(streamingRx) {
+            // block boundary, next refill starts at sampleIndex
+            applyCommands(sampleIndex, sequence);
+
+            ssize_t count = iio_buffer_refill(rxBuf);
+            if(count < 0) {
+                cerr << "RX buffer refill failed: " << count << ", reconnecting" << endl;
 
-            // start streaming
-            streamingRx = true;
+                // buffer belongs to the dead context
+                iio_buffer_destroy(rxBuf);
 
-            while(streamingRx) {
-                ssize_t count = iio_buffer_refill(rxBuf);
+                RxGap gap;
+                gap.firstSample = sampleIndex;
+                rxBuf = recoverRxStream(gap.attempts);
+                if(nullptr == rxBuf) {
+                    // stopped while recovering
+                    return true;
+                }
 
+                // samples that would have arrived since last good refill
+                chrono::steady_clock::time_point now = chrono::steady_clock::now();
+                gap.outageMs = chrono::duration<double, milli>(now - lastRefill).count();
+                long long rate = rx->getConfig().samplingRate;
+                if(rate <= 0) {
+                    rate = rx->getSamplingRate();
+                }
+                gap.lostSamples = static_cast<unsigned long long>(gap.outageMs * rate / 1000.0);
+                sampleIndex += gap.lostSamples;
+                lastRefill = now;
+
+                if(gapCallback) {
+                    gapCallback(gap);
+                }
+                continue;
+            }
+            lastRefill = chrono::steady_clock::now();
+
+            if(!callback) {
                 int step = iio_buffer_step(rxBuf);
 
                 cout << "Got " << count << " bytes in " << count / step << " I/Q samples" << endl;
+                sequence++;
+                sampleIndex += count / step;
+                continue;
+            }
+
+            // execute callback
+            shared_ptr<RxBlock> block = pool->acquire();
+            const char* start = static_cast<const char*>(iio_buffer_start(rxBuf));
+            const char* end = static_cast<const char*>(iio_buffer_end(rxBuf));
+
+            block->sequence = sequence++;
+            block->firstSample = sampleIndex;
+            block->timestamp = chrono::system_clock::now();
+            block->channels = chains;
+            // whole samples only, every chain sees the same block boundaries
+            block->samples.resize((end - start) / sizeof(int16_t) / (2 * chains) * (2 * chains));
+            memcpy(block->samples.data(), start, block->samples.size() * sizeof(int16_t));
+            sampleIndex += block->sampleCount();
+
+            callback(block);
+        }
+        // stop streaming
+        rx->disableStream();
+        
+        // destroy buffer
+        iio_buffer_destroy(rxBuf);
+
+        return true;
+    }
+
+    private:
+    /**
+     * @brief Applies all queued commands, called from streaming thread
+     * 
+     * @param sampleIndex First sample of next refill
+     * @param sequence Sequence number of next block
+     */
+    void applyCommands(unsigned long long sampleIndex, unsigned long long sequence)
+    {
+        Command command;
+
+        while(commands.pop(command)) {
+            Channel* chan = Command::RX == command.target ? rx : tx;
+            bool ok = false;
 
-                // execute callback
+            switch(command.type) {
+            case Command::SET_LO_FREQUENCY:
+                ok = chan->setLoFrequency(command.value);
+                break;
+            case Command::SET_BANDWIDTH:
+                ok = chan->setBandwidthHz(command.value);
+                break;
+            case Command::SET_SAMPLING_RATE:
+                ok = chan->setSamplingRate(command.value);
+                if(ok && Command::RX == command.target) {
+                    // buffer duration changed
+                    applyTimeout();
+                }
+                break;
+            case Command::SET_HARDWARE_GAIN:
+                if(Command::RX == command.target && chan->getConfig().gainControlMode != "manual") {
+                    chan->setGainControlMode("manual");
+                }
+                ok = chan->setHardwareGain(command.value);
+                break;
             }
-            // stop streaming
-            rx->disableStream();
-            
-            // destroy buffer
-            iio_buffer_destroy(rxBuf);
 
-            return true;
+            if(commandCallback) {
+                CommandResult result;
+                result.command = command;
+                result.ok = ok;
+                result.sampleIndex = sampleIndex;
+                result.blockSequence = sequence;
+                // every block until then may predate the change
+                result.settledBlockSequence = sequence + kernelBuffers + 1;
+                result.settledSampleIndex = sampleIndex + (kernelBuffers + 1) * rxBufferSamples;
+                commandCallback(result);
+            }
+        }
+    }
+
+    /**
+     * @brief Finds streaming channel, falls back to altvoltage naming
+     * 
+     * @param dev Streaming device
+     * @param index Channel index, I and Q of chain n are 2n and 2n+1
+     * @param output Look for output channel
+     * @return iio_channel* Channel or nullptr when not found
+     */
+    static iio_channel* findStreamChannel(const iio_device* dev, unsigned int index, bool output)
+    {
+        string id = to_string(index);
+
+        iio_channel* chan = iio_device_find_channel(dev, ("voltage" + id).c_str(), output);
+        if(nullptr == chan) {
+            chan = iio_device_find_channel(dev, ("altvoltage" + id).c_str(), output);
+        }
+        return chan;
+    }
+
+    /**
+     * @brief Sets context timeout, explicit or derived from RX buffer duration
+     * 
+     */
+    void applyTimeout()
+    {
+        unsigned int ms = timeoutMs;
+        if(0 == ms) {
+            long long rate = rx->getConfig().samplingRate;
+            if(rate <= 0) {
+                rate = rx->getSamplingRate();
+            }
+            if(rate <= 0) {
+                // rate unknown, keep libiio default
+                return;
+            }
+            // margin covers network transfer of the buffer
+            ms = static_cast<unsigned int>(rxBufferSamples * 1000 / rate) + 200;
+        }
+        iio_context_set_timeout(ctx, ms);
+    }
+
+    /**
+     * @brief Socket address of iiod
+     */
+    struct IiodAddr {
+        sockaddr_storage addr;
+        socklen_t len;
+    };
+
+    /**
+     * @brief Resolves iiod socket addresses
+     * 
+     * @param address Host name or IP address of iiod
+     * @param addrs Store addresses to, left empty when lookup failed
+     */
+    static void resolveIiod(const string &address, vector<IiodAddr> &addrs)
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo* res = nullptr;
+        if(0 != getaddrinfo(address.c_str(), IIOD_PORT, &hints, &res)) {
+            return;
+        }
+        for(addrinfo* ai = res; nullptr != ai; ai = ai->ai_next) {
+            IiodAddr a;
+            memcpy(&a.addr, ai->ai_addr, ai->ai_addrlen);
+            a.len = ai->ai_addrlen;
+            addrs.push_back(a);
+        }
+        freeaddrinfo(res);
+    }
+
+    /**
+     * @brief Checks whether iiod accepts connections
+     * 
+     * @param addrs Resolved iiod addresses, tried in order
+     * @param timeoutMs Maximum time to wait for each connection
+     * @return true iiod port is reachable
+     * @return false Connection failed or timed out
+     */
+    static bool probeIiod(const vector<IiodAddr> &addrs, unsigned int timeoutMs)
+    {
+        bool reachable = false;
+        for(size_t i = 0; i < addrs.size() && !reachable; i++) {
+            const sockaddr* sa = reinterpret_cast<const sockaddr*>(&addrs[i].addr);
+            int fd = socket(sa->sa_family, SOCK_STREAM, 0);
+            if(fd < 0) {
+                continue;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+            if(0 == connect(fd, sa, addrs[i].len)) {
+                reachable = true;
+            }
+            else if(EINPROGRESS == errno) {
+                pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+
+                int err = 0;
+                socklen_t len = sizeof(err);
+                reachable = 1 == poll(&pfd, 1, timeoutMs) &&
+                    0 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) && 0 == err;
+            }
+            close(fd);
+        }
+        return reachable;
+    }
+
+    /**
+     * @brief Devices and channels of one context
+     */
+    struct Handles {
+        iio_device* devTx;
+        iio_device* devRx;
+        iio_device* devPhy;
+        vector<iio_channel*> streamChansTx;
+        vector<iio_channel*> streamChansRx;
+        vector<iio_channel*> phyChansTx;
+        vector<iio_channel*> phyChansRx;
+        iio_channel* loChanTx;
+        iio_channel* loChanRx;
+    };
+
+    /**
+     * @brief Looks up all devices and channels used by AD9361
+     * 
+     * @param ctx Context to search
+     * @param chains Number of RF chains to stream
+     * @param handles Store devices and channels to
+     * @return true Everything was found
+     * @return false Some device or channel is missing
+     */
+    static bool findHandles(const iio_context* ctx, unsigned int chains, Handles &handles)
+    {
+        // get devices
+        handles.devTx = iio_context_find_device(ctx, "cf-ad9361-dds-core-lpc");
+        if(nullptr == handles.devTx) {
+            return false;
+        }
+
+        handles.devRx = iio_context_find_device(ctx, "cf-ad9361-lpc");
+        if(nullptr == handles.devRx) {
+            return false;
+        }
+
+        handles.devPhy = iio_context_find_device(ctx, "ad9361-phy");
+        if(nullptr == handles.devPhy) {
+            return false;
+        }
+
+        // get channels, I and Q for every chain
+        for(unsigned int i = 0; i < 2 * chains; i++) {
+            iio_channel* chan = findStreamChannel(handles.devRx, i, false);
+            if(nullptr == chan) {
+                return false;
+            }
+            handles.streamChansRx.push_back(chan);
+
+            chan = findStreamChannel(handles.devTx, i, true);
+            if(nullptr == chan) {
+                return false;
+            }
+            handles.streamChansTx.push_back(chan);
+        }
+
+        handles.loChanRx = iio_device_find_channel(handles.devPhy, "altvoltage0", true);
+        if(nullptr == handles.loChanRx) {
+            return false;
+        }
+        handles.loChanTx = iio_device_find_channel(handles.devPhy, "altvoltage1", true);
+        if(nullptr == handles.loChanTx) {
+            return false;
+        }
+
+        // gain and gain control mode are per chain
+        for(unsigned int i = 0; i < chains; i++) {
+            string id = "voltage" + to_string(i);
+
+            iio_channel* chan = iio_device_find_channel(handles.devPhy, id.c_str(), false);
+            if(nullptr == chan) {
+                return false;
+            }
+            handles.phyChansRx.push_back(chan);
+
+            chan = iio_device_find_channel(handles.devPhy, id.c_str(), true);
+            if(nullptr == chan) {
+                return false;
+            }
+            handles.phyChansTx.push_back(chan);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reconnects until RX buffer can be created again
+     * 
+     * @param attempts Incremented for every reconnect attempt
+     * @return iio_buffer* New RX buffer, nullptr when streaming was stopped
+     */
+    iio_buffer* recoverRxStream(unsigned int &attempts)
+    {
+        unsigned int backoffMs = 10;
+
+        while(streamingRx) {
+            attempts++;
+            if(reconnect()) {
+                rx->enableStream();
+                iio_device_set_kernel_buffers_count(devRx, kernelBuffers);
+                iio_buffer* rxBuf = iio_device_create_buffer(devRx, rxBufferSamples, false);
+                if(nullptr != rxBuf) {
+                    return rxBuf;
+                }
+            }
+
+            this_thread::sleep_for(chrono::milliseconds(backoffMs));
+            backoffMs = min(backoffMs * 2, 250u);
         }
+        return nullptr;
     }
 
+    public:
     /**
      * @brief Stops RX Streaming
      * 
@@ -454,27 +1144,42 @@ public:
      * 
      */
     AD9361() :
+        ctx(nullptr),
+        devTx(nullptr),
+        devRx(nullptr),
+        devPhy(nullptr),
+        tx(nullptr),
+        rx(nullptr),
+        chains(1),
+        timeoutMs(0),
+        connectTimeoutMs(250),
+        rxBufferSamples(1024*1024),
+        kernelBuffers(4),
+        commands(64),
         ready(false),
         streamingRx(false)
     {}
 private:
+    string address;
     iio_context* ctx;
     iio_device* devTx;
     iio_device* devRx;
     iio_device* devPhy;
 
-    iio_channel* streamChanTxQ;
-    iio_channel* streamChanTxI;
-    iio_channel* streamChanRxQ;
-    iio_channel* streamChanRxI;
-    iio_channel* phyChanTx;
-    iio_channel* phyChanRx;
-    iio_channel* loChanTx;
-    iio_channel* loChanRx;
-
     Channel* tx;
     Channel* rx;
 
+    unsigned int chains;
+    unsigned int timeoutMs;
+    unsigned int connectTimeoutMs;
+    vector<IiodAddr> iiodAddrs;
+    size_t rxBufferSamples;
+    unsigned int kernelBuffers;
+    RxGapCallback gapCallback;
+
+    LockFreeQueue<Command> commands;
+    CommandCallback commandCallback;
+
     bool ready;
-    bool streamingRx;
+    atomic<bool> streamingRx;
 };
@@ -0,0 +1,117 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+/**
+ * @brief Blocking bounded queue connecting two pipeline threads
+ *
+ * Producer waits while the queue is full, so a slow stage slows down
+ * the stages before it instead of piling up memory.
+ */
+template<typename T>
+class BoundedQueue {
+public:
+    /**
+     * @brief Adds item, waits while queue is full
+     *
+     * @param item Item to add, moved from
+     * @return true Item was queued
+     * @return false Queue was closed
+     */
+    bool push(T &item)
+    {
+        unique_lock<mutex> lock(mtx);
+        notFull.wait(lock, [this] { return queue.size() < depth || closed; });
+        if(closed) {
+            return false;
+        }
+
+        queue.push_back(std::move(item));
+        lock.unlock();
+
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Takes oldest item, waits while queue is empty
+     *
+     * @param item Store item to
+     * @return true Item was taken
+     * @return false Queue was closed and is drained
+     */
+    bool pop(T &item)
+    {
+        unique_lock<mutex> lock(mtx);
+        notEmpty.wait(lock, [this] { return !queue.empty() || closed; });
+        if(queue.empty()) {
+            return false;
+        }
+
+        item = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+
+        notFull.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Stops producers, consumers still get queued items
+     *
+     */
+    void close()
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+        }
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    /**
+     * @brief Get number of queued items
+     *
+     * @return size_t Queued items
+     */
+    size_t size()
+    {
+        lock_guard<mutex> lock(mtx);
+        return queue.size();
+    }
+
+    explicit BoundedQueue(size_t depth) :
+        depth(depth > 0 ? depth : 1),
+        closed(false) {}
+
+private:
+    size_t depth;
+    bool closed;
+
+    mutex mtx;
+    condition_variable notEmpty;
+    condition_variable notFull;
+    deque<T> queue;
+};
+
+#endif // BOUNDEDQUEUE_H
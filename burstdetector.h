@@ -0,0 +1,374 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef BURSTDETECTOR_H
+#define BURSTDETECTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "rxblock.h"
+
+using namespace std;
+
+/**
+ * @brief Sum of I*I + Q*Q over interleaved 16 bit samples
+ *
+ * Squares are summed as unsigned 32 bit pairs before widening. A pair
+ * peaks at 2^31, so the sum is exact for every input.
+ *
+ * @param x Interleaved I/Q samples
+ * @param n Number of int16 values, i.e. twice the I/Q sample count
+ * @return uint64_t Sum of squares
+ */
+static inline uint64_t sumSquares(const int16_t* x, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i sq = _mm_madd_epi16(v, v);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+    sum = lanes[0] + lanes[1];
+#elif defined(__ARM_NEON)
+    uint64x2_t acc = vdupq_n_u64(0);
+    for(; i + 8 <= n; i += 8) {
+        int16x8_t v = vld1q_s16(x + i);
+        int32x4_t sq = vmull_s16(vget_low_s16(v), vget_low_s16(v));
+        sq = vmlal_s16(sq, vget_high_s16(v), vget_high_s16(v));
+        acc = vpadalq_u32(acc, vreinterpretq_u32_s32(sq));
+    }
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+
+    for(; i < n; i++) {
+        sum += static_cast<int32_t>(x[i]) * x[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Detects energy bursts in RX stream and keeps only those
+ *
+ * Power is averaged over fixed windows. A burst starts at the first
+ * window above threshold and ends once power stayed below threshold
+ * minus hysteresis for the post-trigger time. Recent blocks are kept in
+ * a ring so the burst also covers the pre-trigger time. Blocks are held
+ * by reference, nothing is copied. Bursts longer than maxBurstSamples,
+ * e.g. a continuous carrier, are reported in consecutive segments so
+ * held blocks stay bounded.
+ */
+class BurstDetector {
+public:
+    struct Config {
+        double thresholdDbfs;           // Window power starting a burst
+        double hysteresisDb;            // Burst continues down to threshold minus this
+        size_t windowSamples;           // I/Q samples per power window
+        unsigned long long preTriggerSamples;  // Kept before first window above threshold
+        unsigned long long postTriggerSamples; // Kept after last window above release level
+        double fullScale;               // Amplitude of 0 dBFS, 2048 for 12 bit AD9361 data
+        long long sampleRate;           // Used for burst start time, 0 to use block time
+        unsigned long long maxBurstSamples; // Longest segment reported at once, 0 for no limit
+
+        Config() :
+            thresholdDbfs(-30.0),
+            hysteresisDb(3.0),
+            windowSamples(4096),
+            preTriggerSamples(0),
+            postTriggerSamples(0),
+            fullScale(2048.0),
+            sampleRate(0),
+            maxBurstSamples(16 * 1024 * 1024) {}
+    };
+
+    /**
+     * @brief Detected burst
+     */
+    struct Burst {
+        unsigned long long id;          // Burst counter
+        unsigned long long startSample; // First sample including pre-trigger
+        unsigned long long triggerSample; // First sample of window that triggered
+        unsigned long long endSample;   // One past last sample including post-trigger
+        chrono::system_clock::time_point startTime; // Time of startSample
+        double peakDbfs;                // Highest window power in segment
+        unsigned int segment;           // Segment number, 0 unless burst was split
+        bool last;                      // Burst ends with this segment
+        vector<RxBlockPtr> blocks;      // Blocks covering startSample..endSample
+    };
+
+    typedef function<void(const Burst&)> BurstCallback;
+
+    struct Stats {
+        unsigned long long samplesIn;   // I/Q samples processed
+        unsigned long long samplesOut;  // I/Q samples inside reported bursts
+        unsigned long long bursts;      // Bursts reported, split bursts count once
+        double lastWindowDbfs;          // Power of last complete window
+    };
+
+    /**
+     * @brief Processes next block, called in stream order
+     *
+     * @param block Block to process
+     */
+    void process(const RxBlockPtr &block)
+    {
+        size_t count = block->sampleCount();
+        if(0 == count) {
+            return;
+        }
+
+        bool continuous = started && block->firstSample == nextSample && block->channels == channels;
+        if(started && !continuous) {
+            // gap in stream, e.g. after reconnect
+            if(active) {
+                finishBurst(min(nextSample, burst.endSample));
+            }
+            history.clear();
+            windowSum = 0;
+            windowFill = 0;
+        }
+        if(!continuous) {
+            streamStart = block->firstSample;
+            channels = block->channels;
+        }
+        started = true;
+        nextSample = block->firstSample + count;
+        stats.samplesIn += count;
+
+        history.push_back(block);
+        trimHistory();
+        if(active) {
+            burst.blocks.push_back(block);
+        }
+
+        // power of all chains is averaged
+        const int16_t* samples = block->samples.data();
+        size_t stride = 2 * channels;
+        size_t pos = 0;
+        while(pos < count) {
+            size_t take = min(count - pos, config.windowSamples - windowFill);
+            windowSum += sumSquares(samples + stride * pos, stride * take);
+            windowFill += take;
+            pos += take;
+
+            if(windowFill == config.windowSamples) {
+                unsigned long long windowEnd = block->firstSample + pos;
+                evaluateWindow(windowEnd - config.windowSamples, windowEnd);
+                windowSum = 0;
+                windowFill = 0;
+            }
+        }
+
+        if(active && config.maxBurstSamples > 0 && nextSample - burst.startSample >= config.maxBurstSamples) {
+            splitBurst();
+        }
+    }
+
+    /**
+     * @brief Reports burst still open, call when stream ends
+     *
+     */
+    void flush()
+    {
+        if(active) {
+            finishBurst(min(nextSample, burst.endSample));
+        }
+    }
+
+    /**
+     * @brief Get callback feeding blocks into detector
+     *
+     * @return RxCallback Callback for AD9361::startRxStream
+     */
+    RxCallback callback()
+    {
+        return [this](const RxBlockPtr &block) { process(block); };
+    }
+
+    /**
+     * @brief Get detector counters
+     *
+     * @return const Stats& Counters
+     */
+    const Stats& getStats() const { return stats; }
+
+    BurstDetector(const Config &config, BurstCallback onBurst) :
+        config(config),
+        onBurst(onBurst),
+        started(false),
+        active(false),
+        channels(1),
+        streamStart(0),
+        nextSample(0),
+        windowSum(0),
+        windowFill(0),
+        burstCount(0)
+    {
+        if(0 == this->config.windowSamples) {
+            this->config.windowSamples = 1;
+        }
+        stats = Stats();
+        stats.lastWindowDbfs = -INFINITY;
+
+        // thresholds as raw sums of squares over one window
+        double scale = this->config.fullScale * this->config.fullScale * this->config.windowSamples;
+        triggerLevel = scale * pow(10.0, this->config.thresholdDbfs / 10.0);
+        releaseLevel = scale * pow(10.0, (this->config.thresholdDbfs - this->config.hysteresisDb) / 10.0);
+    }
+
+private:
+    void evaluateWindow(unsigned long long windowStart, unsigned long long windowEnd)
+    {
+        double level = static_cast<double>(windowSum) / channels;
+        double dbfs = 10.0 * log10(level / (config.fullScale * config.fullScale * config.windowSamples) + 1e-30);
+        stats.lastWindowDbfs = dbfs;
+
+        if(!active) {
+            if(level < triggerLevel) {
+                return;
+            }
+            startBurst(windowStart);
+        }
+
+        if(level >= releaseLevel) {
+            burst.endSample = windowEnd + config.postTriggerSamples;
+            if(dbfs > burst.peakDbfs) {
+                burst.peakDbfs = dbfs;
+            }
+        }
+        else if(windowEnd >= burst.endSample) {
+            finishBurst(burst.endSample);
+        }
+    }
+
+    void startBurst(unsigned long long triggerSample)
+    {
+        active = true;
+        burst.id = burstCount++;
+        burst.triggerSample = triggerSample;
+        burst.startSample = triggerSample - min(config.preTriggerSamples, triggerSample - streamStart);
+        burst.endSample = triggerSample;
+        burst.peakDbfs = -INFINITY;
+        burst.segment = 0;
+        burst.last = false;
+        burst.blocks.clear();
+
+        for(size_t i = 0; i < history.size(); i++) {
+            if(history[i]->firstSample + history[i]->sampleCount() > burst.startSample) {
+                burst.blocks.push_back(history[i]);
+            }
+        }
+        burst.startTime = sampleTime(burst.blocks.front(), burst.startSample);
+    }
+
+    void finishBurst(unsigned long long endSample)
+    {
+        // end may fall before a segment split off while waiting for release
+        burst.endSample = max(endSample, burst.startSample);
+        burst.last = true;
+
+        // drop blocks fully after the end, they were added while waiting for release
+        while(!burst.blocks.empty() && burst.blocks.back()->firstSample >= burst.endSample) {
+            burst.blocks.pop_back();
+        }
+
+        stats.bursts++;
+        stats.samplesOut += burst.endSample - burst.startSample;
+        if(onBurst) {
+            onBurst(burst);
+        }
+
+        active = false;
+        burst.blocks.clear();
+    }
+
+    void splitBurst()
+    {
+        // report everything up to the newest block, burst goes on in next segment
+        unsigned long long pendingEnd = burst.endSample;
+        burst.endSample = nextSample;
+
+        stats.samplesOut += burst.endSample - burst.startSample;
+        if(onBurst) {
+            onBurst(burst);
+        }
+
+        burst.startTime = sampleTime(burst.blocks.back(), nextSample);
+        burst.startSample = nextSample;
+        burst.endSample = pendingEnd;
+        burst.peakDbfs = -INFINITY;
+        burst.segment++;
+        burst.blocks.clear();
+    }
+
+    void trimHistory()
+    {
+        // keep enough blocks to start a burst in the newest block with full pre-trigger
+        unsigned long long keepFrom = history.back()->firstSample;
+        unsigned long long keep = config.preTriggerSamples + config.windowSamples;
+        keepFrom = keepFrom > keep ? keepFrom - keep : 0;
+
+        while(history.size() > 1 && history[1]->firstSample <= keepFrom) {
+            history.pop_front();
+        }
+    }
+
+    chrono::system_clock::time_point sampleTime(const RxBlockPtr &block, unsigned long long sample) const
+    {
+        if(config.sampleRate <= 0) {
+            return block->timestamp;
+        }
+        // block timestamp marks its last sample
+        long long before = static_cast<long long>(block->firstSample + block->sampleCount()) -
+            static_cast<long long>(sample);
+        return block->timestamp - chrono::duration_cast<chrono::system_clock::duration>(
+            chrono::duration<double>(static_cast<double>(before) / config.sampleRate));
+    }
+
+    Config config;
+    BurstCallback onBurst;
+    Stats stats;
+
+    bool started;
+    bool active;
+    unsigned int channels;
+    unsigned long long streamStart;
+    unsigned long long nextSample;
+    uint64_t windowSum;
+    size_t windowFill;
+    double triggerLevel;
+    double releaseLevel;
+
+    deque<RxBlockPtr> history;
+    Burst burst;
+    unsigned long long burstCount;
+};
+
+#endif // BURSTDETECTOR_H
@@ -0,0 +1,106 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef DEINTERLEAVE_H
+#define DEINTERLEAVE_H
+
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "rxblock.h"
+
+using namespace std;
+
+/**
+ * @brief Splits 2 chain samples I0 Q0 I1 Q1 into two I/Q streams
+ *
+ * An I/Q pair is moved as one 32 bit word, so this is a stride 2
+ * deinterleave of words.
+ *
+ * @param in Interleaved samples, 4 int16 per sample time
+ * @param count Number of sample times
+ * @param out0 Receives I0 Q0 pairs, 2 * count int16
+ * @param out1 Receives I1 Q1 pairs, 2 * count int16
+ */
+static inline void deinterleave2(const int16_t* in, size_t count, int16_t* out0, int16_t* out1)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    for(; i + 4 <= count; i += 4) {
+        // words: a = s0c0 s0c1 s1c0 s1c1, b = s2c0 s2c1 s3c0 s3c1
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * i + 8));
+        a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+        b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out0 + 2 * i), _mm_unpacklo_epi64(a, b));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out1 + 2 * i), _mm_unpackhi_epi64(a, b));
+    }
+#elif defined(__ARM_NEON)
+    for(; i + 4 <= count; i += 4) {
+        uint32x4x2_t v = vld2q_u32(reinterpret_cast<const uint32_t*>(in + 4 * i));
+        vst1q_u32(reinterpret_cast<uint32_t*>(out0 + 2 * i), v.val[0]);
+        vst1q_u32(reinterpret_cast<uint32_t*>(out1 + 2 * i), v.val[1]);
+    }
+#endif
+
+    for(; i < count; i++) {
+        memcpy(out0 + 2 * i, in + 4 * i, 2 * sizeof(int16_t));
+        memcpy(out1 + 2 * i, in + 4 * i + 2, 2 * sizeof(int16_t));
+    }
+}
+
+/**
+ * @brief Splits block into one interleaved I/Q stream per chain
+ *
+ * Sample n of every output belongs to the same sample time, so outputs
+ * of one block stay phase coherent with each other.
+ *
+ * @param block Block to split
+ * @param out Resized to block.channels streams of 2 * sampleCount int16
+ */
+static inline void deinterleave(const RxBlock &block, vector<vector<int16_t> > &out)
+{
+    size_t count = block.sampleCount();
+    unsigned int channels = block.channels;
+    const int16_t* in = block.samples.data();
+
+    out.resize(channels);
+    for(unsigned int c = 0; c < channels; c++) {
+        out[c].resize(2 * count);
+    }
+
+    switch(channels) {
+    case 1:
+        memcpy(out[0].data(), in, 2 * count * sizeof(int16_t));
+        break;
+    case 2:
+        deinterleave2(in, count, out[0].data(), out[1].data());
+        break;
+    default:
+        for(size_t i = 0; i < count; i++) {
+            for(unsigned int c = 0; c < channels; c++) {
+                memcpy(&out[c][2 * i], in + 2 * (i * channels + c), 2 * sizeof(int16_t));
+            }
+        }
+        break;
+    }
+}
+
+#endif // DEINTERLEAVE_H
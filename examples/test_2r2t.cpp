@@ -0,0 +1,58 @@
+#include <iostream>
+#include <cmath>
+#include <complex>
+#include <signal.h>
+#include "ad9361.h"
+#include "deinterleave.h"
+
+AD9361 ad9361;
+
+static void handle_sig(int sig)
+{
+	cout << "Waiting for streaming to stop" << endl;
+	ad9361.stopRxStream();
+}
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+    string devIp("192.168.2.1");
+
+    // Init AD9361 device with both receive chains
+    if(!ad9361.init(devIp, 2)) {
+        cerr << "Unable to initialize 2R2T AD9361 context on " << devIp << endl;
+        return -1;
+    }
+
+    // install sigact to interrupt streaming
+    signal(SIGINT, handle_sig);
+
+    vector<vector<int16_t> > antennas;
+
+    // start rx stream, print phase of antenna 1 relative to antenna 0
+    bool ok = ad9361.startRxStream(96000000, [&antennas](const RxBlockPtr &block) {
+        deinterleave(*block, antennas);
+
+        complex<double> corr(0, 0);
+        double power[2] = { 0, 0 };
+        for(size_t i = 0; i < block->sampleCount(); i++) {
+            complex<double> a0(antennas[0][2 * i], antennas[0][2 * i + 1]);
+            complex<double> a1(antennas[1][2 * i], antennas[1][2 * i + 1]);
+            corr += a1 * conj(a0);
+            power[0] += norm(a0);
+            power[1] += norm(a1);
+        }
+
+        cout << "Block " << block->sequence
+             << " power " << 10 * log10(power[0] + 1) << " / " << 10 * log10(power[1] + 1) << " dB"
+             << " phase " << arg(corr) * 180 / M_PI << " deg" << endl;
+    });
+    if(!ok) {
+        cerr << "Unable to start RX streaming" << endl;
+    }
+
+    ad9361.deinit();
+    cout << "Done, exiting" << endl;
+
+    return 0;
+}
@@ -1,8 +1,16 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <iomanip>
 #include <signal.h>
+#include <thread>
 #include "ad9361.h"
+#include "rxfanout.h"
+#include "fmdemod.h"
 
 AD9361 ad9361;
+RxFanout rxFanout;
 
 static void handle_sig(int sig)
 {
@@ -10,10 +18,44 @@ static void handle_sig(int sig)
 	ad9361.stopRxStream();
 }
 
+/* prints per stage CPU use and latency of every station */
+static void print_stats(const vector<shared_ptr<FmStation> > &stations)
+{
+    for(size_t i = 0; i < stations.size(); i++) {
+        FmStation::Stats stats = stations[i]->getStats();
+        cout << fixed << setprecision(1) << stations[i]->getName() << " MHz"
+             << " cpu% channel " << stats.channel.utilization * 100
+             << " discriminator " << stats.discriminator.utilization * 100
+             << " audio " << stats.audio.utilization * 100
+             << " latency " << stats.lastLatencyMs << " ms (max " << stats.maxLatencyMs << ")" << endl;
+    }
+}
+
 int main(int argc, char **argv)
 {
     using namespace std;
     string devIp("192.168.2.1");
+    const long long loHz = 96000000;
+    const long long sampleRate = 2400000;
+
+    // stations in MHz, must be within +-1 MHz of LO
+    vector<double> stationsMHz;
+    for(int i = 1; i < argc; i++) {
+        stationsMHz.push_back(atof(argv[i]));
+    }
+    if(stationsMHz.empty()) {
+        stationsMHz.push_back(95.5);
+        stationsMHz.push_back(96.3);
+    }
+
+    // refill timeout follows buffer duration, a lost link is noticed after
+    // ~230 ms and the stream resumes ~0.5 s after the device is back
+    ad9361.setGapCallback([](const RxGap &gap) {
+        cout << "Stream resumed after " << gap.outageMs << " ms, lost "
+             << gap.lostSamples << " I/Q samples" << endl;
+    });
+    // ~27 ms per refill keeps audio latency low
+    ad9361.setRxBufferSamples(65536);
     
     // Init AD9361 device
     if(!ad9361.init(devIp)) {
@@ -21,16 +63,66 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    // applied by streaming thread before first refill
+    ad9361.submitCommand(AD9361::Command(AD9361::Command::SET_SAMPLING_RATE, AD9361::Command::RX, sampleRate));
+    ad9361.submitCommand(AD9361::Command(AD9361::Command::SET_BANDWIDTH, AD9361::Command::RX, 2000000));
+
+    // one demodulator per station, each with its own stage threads
+    vector<shared_ptr<FmStation> > stations;
+    vector<shared_ptr<ofstream> > outputs;
+    for(size_t i = 0; i < stationsMHz.size(); i++) {
+        ostringstream name;
+        name << stationsMHz[i];
+
+        FmStation::Config cfg;
+        cfg.name = name.str();
+        cfg.sampleRate = sampleRate;
+        cfg.offsetHz = stationsMHz[i] * 1e6 - loHz;
+
+        // raw 16 bit mono, play with: aplay -f S16_LE -r 48000 station_<MHz>.raw
+        shared_ptr<ofstream> out(new ofstream(("station_" + name.str() + ".raw").c_str(), ios::binary));
+        outputs.push_back(out);
+
+        // audio must not have holes, producer waits for slow stations
+        shared_ptr<RxFanout::Consumer> consumer =
+            rxFanout.addConsumer(cfg.name, RxFanout::BLOCK, 8);
+
+        stations.push_back(shared_ptr<FmStation>(new FmStation(cfg, consumer, [out](const AudioChunk &chunk) {
+            vector<int16_t> pcm(chunk.samples.size());
+            for(size_t k = 0; k < pcm.size(); k++) {
+                float v = chunk.samples[k] * 32767.0f;
+                pcm[k] = static_cast<int16_t>(max(-32768.0f, min(32767.0f, v)));
+            }
+            out->write(reinterpret_cast<const char*>(pcm.data()), pcm.size() * sizeof(int16_t));
+        })));
+        stations.back()->start();
+    }
+
     // install sigact to interrupt streaming
     signal(SIGINT, handle_sig);
+
+    atomic<bool> streaming(true);
+    thread statsThread([&stations, &streaming] {
+        while(streaming) {
+            this_thread::sleep_for(chrono::seconds(1));
+            print_stats(stations);
+        }
+    });
     
     // start rx stream
-    if(!ad9361.startRxStream(96000000)) {
+    if(!ad9361.startRxStream(loHz, rxFanout.callback())) {
         cerr << "Unable to start RX streaming" << endl;
     }
 
+    rxFanout.close();
+    for(size_t i = 0; i < stations.size(); i++) {
+        stations[i]->stop();
+    }
+    streaming = false;
+    statsThread.join();
+
     ad9361.deinit();
     cout << "Done, exiting" << endl;
 
     return 0;
-}
\ No newline at end of file
+}
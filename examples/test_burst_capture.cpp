@@ -0,0 +1,98 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <signal.h>
+#include <thread>
+#include "ad9361.h"
+#include "rxfanout.h"
+#include "burstdetector.h"
+
+AD9361 ad9361;
+RxFanout rxFanout;
+
+static void handle_sig(int sig)
+{
+	cout << "Waiting for streaming to stop" << endl;
+	ad9361.stopRxStream();
+}
+
+/* writes samples of burst as raw interleaved int16 I/Q, segments of long bursts are appended */
+static void write_burst(const BurstDetector::Burst &burst)
+{
+    ostringstream name;
+    name << "burst_" << burst.id << ".iq";
+    ofstream out(name.str().c_str(), burst.segment > 0 ? ios::binary | ios::app : ios::binary);
+
+    for(size_t i = 0; i < burst.blocks.size(); i++) {
+        const RxBlock &block = *burst.blocks[i];
+        unsigned long long from = max(block.firstSample, burst.startSample);
+        unsigned long long to = min(block.firstSample + block.sampleCount(), burst.endSample);
+        if(to <= from) {
+            continue;
+        }
+        size_t stride = 2 * block.channels;
+        out.write(reinterpret_cast<const char*>(&block.samples[stride * (from - block.firstSample)]),
+            (to - from) * stride * sizeof(int16_t));
+    }
+
+    time_t start = chrono::system_clock::to_time_t(burst.startTime);
+    cout << "Burst " << burst.id << " segment " << burst.segment << " at " << ctime(&start)
+         << "  samples " << burst.startSample << ".." << burst.endSample
+         << " peak " << burst.peakDbfs << " dBFS -> " << name.str() << endl;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+    string devIp("192.168.2.1");
+
+    // Init AD9361 device
+    if(!ad9361.init(devIp)) {
+        cerr << "Unable to initialize AD9361 context on " << devIp << endl;
+        return -1;
+    }
+
+    BurstDetector::Config cfg;
+    cfg.thresholdDbfs = argc > 1 ? atof(argv[1]) : -30.0;
+    cfg.hysteresisDb = 3.0;
+    cfg.sampleRate = ad9361.getRx()->getSamplingRate();
+    cfg.preTriggerSamples = cfg.sampleRate / 100;   // 10 ms
+    cfg.postTriggerSamples = cfg.sampleRate / 20;   // 50 ms
+    BurstDetector detector(cfg, write_burst);
+
+    // detector must see every block, it runs off the streaming thread
+    shared_ptr<RxFanout::Consumer> consumer =
+        rxFanout.addConsumer("burst", RxFanout::BLOCK, 8);
+
+    thread detectorThread([consumer, &detector] {
+        RxBlockPtr block;
+        RxFanout::PopResult result;
+        // keep popping through quiet periods, a BLOCK consumer that quits stalls the stream
+        while(RxFanout::CLOSED != (result = consumer->pop(block, 1000))) {
+            if(RxFanout::POPPED == result) {
+                detector.process(block);
+            }
+        }
+        detector.flush();
+    });
+
+    // install sigact to interrupt streaming
+    signal(SIGINT, handle_sig);
+
+    // start rx stream
+    if(!ad9361.startRxStream(96000000, rxFanout.callback())) {
+        cerr << "Unable to start RX streaming" << endl;
+    }
+
+    rxFanout.close();
+    detectorThread.join();
+
+    const BurstDetector::Stats &stats = detector.getStats();
+    cout << stats.bursts << " bursts, kept " << stats.samplesOut << " of "
+         << stats.samplesIn << " I/Q samples" << endl;
+
+    ad9361.deinit();
+    cout << "Done, exiting" << endl;
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <signal.h>
+#include "ad9361.h"
+#include "shmring.h"
+
+AD9361 ad9361;
+ShmRingPublisher publisher;
+
+static void handle_sig(int sig)
+{
+	cout << "Waiting for streaming to stop" << endl;
+	ad9361.stopRxStream();
+}
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+    string devIp("192.168.2.1");
+    string shmName(argc > 1 ? argv[1] : "/ad9361_rx");
+
+    // Init AD9361 device
+    if(!ad9361.init(devIp)) {
+        cerr << "Unable to initialize AD9361 context on " << devIp << endl;
+        return -1;
+    }
+
+    // room for 8 blocks of 1M I/Q samples
+    if(!publisher.open(shmName, 8, 1024 * 1024 * 2 * sizeof(int16_t))) {
+        cerr << "Unable to create shared memory ring " << shmName << endl;
+        ad9361.deinit();
+        return -1;
+    }
+    long long sampleRate = ad9361.getRx()->getSamplingRate();
+    long long loHz = 96000000;
+    publisher.setStreamInfo(sampleRate, loHz);
+
+    // blocks up to settledBlockSequence may still be captured with old settings,
+    // they keep the old info, new info is published from the settled block on
+    long long pendingRate = sampleRate;
+    long long pendingLoHz = loHz;
+    unsigned long long pendingFrom = 0;
+    bool pending = false;
+
+    // streaming thread calls both callbacks, no locking needed
+    ad9361.setCommandCallback([&](const AD9361::CommandResult &result) {
+        if(!result.ok || result.command.target != AD9361::Command::RX) {
+            return;
+        }
+        if(AD9361::Command::SET_LO_FREQUENCY == result.command.type) {
+            pendingLoHz = result.command.value;
+        }
+        else if(AD9361::Command::SET_SAMPLING_RATE == result.command.type) {
+            pendingRate = result.command.value;
+        }
+        else {
+            return;
+        }
+        pendingFrom = max(pendingFrom, result.settledBlockSequence);
+        pending = true;
+    });
+
+    // install sigact to interrupt streaming
+    signal(SIGINT, handle_sig);
+
+    // start rx stream, publishing never waits for subscribers
+    RxCallback publish = [&](const RxBlockPtr &block) {
+        if(pending && block->sequence >= pendingFrom) {
+            publisher.setStreamInfo(pendingRate, pendingLoHz);
+            pending = false;
+        }
+        publisher.publish(*block);
+    };
+    if(!ad9361.startRxStream(loHz, publish)) {
+        cerr << "Unable to start RX streaming" << endl;
+    }
+
+    publisher.close();
+    ad9361.deinit();
+    cout << "Done, exiting" << endl;
+
+    return 0;
+}
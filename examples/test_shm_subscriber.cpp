@@ -0,0 +1,44 @@
+#include <iostream>
+#include <signal.h>
+#include "shmring.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_sig(int sig)
+{
+	running = 0;
+}
+
+int main(int argc, char **argv)
+{
+    using namespace std;
+    string shmName(argc > 1 ? argv[1] : "/ad9361_rx");
+    ShmRingSubscriber subscriber;
+
+    if(!subscriber.open(shmName)) {
+        cerr << "Unable to open shared memory ring " << shmName << endl;
+        return -1;
+    }
+
+    signal(SIGINT, handle_sig);
+
+    ShmRingBlock block;
+    while(running) {
+        if(!subscriber.read(block, 1000)) {
+            if(subscriber.isClosed()) {
+                cout << "Publisher closed ring" << endl;
+                break;
+            }
+            continue;
+        }
+        cout << "Block " << block.blockSequence << " with " << block.samples.size() / (2 * block.channels)
+             << " I/Q samples x " << block.channels << " chains at " << block.sampleRate << " Hz, LO " << block.loHz << " Hz";
+        if(block.lost > 0) {
+            cout << ", lapped, lost " << block.lost << " blocks";
+        }
+        cout << endl;
+    }
+
+    cout << "Done, exiting" << endl;
+    return 0;
+}
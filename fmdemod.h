@@ -0,0 +1,643 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef FMDEMOD_H
+#define FMDEMOD_H
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "rxblock.h"
+#include "rxfanout.h"
+#include "boundedqueue.h"
+
+using namespace std;
+
+/**
+ * @brief Dot product of two float arrays
+ *
+ * @param a First array
+ * @param b Second array
+ * @param n Number of elements
+ * @return float Sum of a[i] * b[i]
+ */
+static inline float dotProduct(const float* a, const float* b, size_t n)
+{
+    float sum = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for(; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#elif defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for(; i + 4 <= n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    sum = vgetq_lane_f32(acc, 0) + vgetq_lane_f32(acc, 1) + vgetq_lane_f32(acc, 2) + vgetq_lane_f32(acc, 3);
+#endif
+
+    for(; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Approximate atan2 over arrays, max error below 1e-5 rad
+ *
+ * Branch free polynomial for atan on [0, 1], then octant fix up.
+ *
+ * @param y Imaginary parts
+ * @param x Real parts
+ * @param out Angles in radians
+ * @param n Number of elements
+ */
+static inline void fastAtan2(const float* y, const float* x, float* out, size_t n)
+{
+    const float c1 = 0.99997726f;
+    const float c3 = -0.33262347f;
+    const float c5 = 0.19354346f;
+    const float c7 = -0.11643287f;
+    const float c9 = 0.05265332f;
+    const float c11 = -0.01172120f;
+    const float halfPi = 1.57079633f;
+    const float pi = 3.14159265f;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 tiny = _mm_set1_ps(1e-30f);
+    for(; i + 4 <= n; i += 4) {
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 ay = _mm_andnot_ps(signMask, vy);
+        __m128 ax = _mm_andnot_ps(signMask, vx);
+
+        __m128 a = _mm_div_ps(_mm_min_ps(ax, ay), _mm_add_ps(_mm_max_ps(ax, ay), tiny));
+        __m128 s = _mm_mul_ps(a, a);
+        __m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(c11), s), _mm_set1_ps(c9));
+        r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(c7));
+        r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(c5));
+        r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(c3));
+        r = _mm_add_ps(_mm_mul_ps(r, s), _mm_set1_ps(c1));
+        r = _mm_mul_ps(r, a);
+
+        // |y| > |x|: pi/2 - r
+        __m128 mask = _mm_cmpgt_ps(ay, ax);
+        r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(_mm_set1_ps(halfPi), r)), _mm_andnot_ps(mask, r));
+        // x < 0: pi - r
+        mask = _mm_cmplt_ps(vx, _mm_setzero_ps());
+        r = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(_mm_set1_ps(pi), r)), _mm_andnot_ps(mask, r));
+        // sign of y
+        r = _mm_xor_ps(r, _mm_and_ps(vy, signMask));
+
+        _mm_storeu_ps(out + i, r);
+    }
+#endif
+
+    for(; i < n; i++) {
+        float ay = fabsf(y[i]);
+        float ax = fabsf(x[i]);
+        float a = fminf(ax, ay) / (fmaxf(ax, ay) + 1e-30f);
+        float s = a * a;
+        float r = ((((c11 * s + c9) * s + c7) * s + c5) * s + c3) * s + c1;
+        r *= a;
+        r = ay > ax ? halfPi - r : r;
+        r = x[i] < 0 ? pi - r : r;
+        out[i] = y[i] < 0 ? -r : r;
+    }
+}
+
+/**
+ * @brief Windowed sinc lowpass with unity gain at DC
+ *
+ * @param taps Number of taps
+ * @param cutoffHz Cutoff frequency
+ * @param rateHz Sampling rate
+ * @return vector<float> Filter taps
+ */
+static inline vector<float> designLowpass(size_t taps, double cutoffHz, double rateHz)
+{
+    vector<float> h(taps);
+    double fc = cutoffHz / rateHz;
+    double mid = (taps - 1) / 2.0;
+    double sum = 0;
+
+    for(size_t i = 0; i < taps; i++) {
+        double t = i - mid;
+        double sinc = fabs(t) < 1e-9 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+        double window = taps > 1 ? 0.54 - 0.46 * cos(2 * M_PI * i / (taps - 1)) : 1.0;
+        h[i] = sinc * window;
+        sum += h[i];
+    }
+    for(size_t i = 0; i < taps; i++) {
+        h[i] /= sum;
+    }
+    return h;
+}
+
+/**
+ * @brief FIR filter computing only every Nth output
+ */
+class FirDecimator {
+public:
+    /**
+     * @brief Filters input and appends decimated output
+     *
+     * @param in Input samples
+     * @param n Number of input samples
+     * @param out Output is appended here
+     */
+    void process(const float* in, size_t n, vector<float> &out)
+    {
+        history.insert(history.end(), in, in + n);
+
+        size_t taps = reversedTaps.size();
+        size_t pos = 0;
+        for(; pos + taps <= history.size(); pos += decimation) {
+            out.push_back(dotProduct(&history[pos], reversedTaps.data(), taps));
+        }
+
+        // keep unconsumed tail for next call
+        history.erase(history.begin(), history.begin() + min(pos, history.size()));
+    }
+
+    FirDecimator(const vector<float> &taps, unsigned int decimation) :
+        reversedTaps(taps.rbegin(), taps.rend()),
+        decimation(decimation > 0 ? decimation : 1)
+    {
+        history.reserve(4096);
+        history.assign(reversedTaps.size() - 1, 0.0f);
+    }
+
+private:
+    vector<float> reversedTaps;
+    unsigned int decimation;
+    vector<float> history;
+};
+
+/**
+ * @brief Demodulated audio of one station
+ */
+struct AudioChunk {
+    vector<float> samples;          // Mono audio, full deviation is +-1
+    chrono::system_clock::time_point timestamp; // Refill time of RX block audio came from
+};
+
+/**
+ * @brief FM broadcast demodulator for one station in the captured band
+ *
+ * Runs three threads connected by bounded queues:
+ * channel selection (mix to baseband, lowpass, decimate to quadrature
+ * rate), discriminator (phase difference of consecutive samples) and
+ * audio (de-emphasis, lowpass, decimate to audio rate). Each station
+ * has its own threads, so stations demodulate in parallel.
+ */
+class FmStation {
+public:
+    struct Config {
+        string name;                // Used for reporting only
+        double sampleRate;          // RX sampling rate in Hz
+        double offsetHz;            // Station frequency minus LO frequency
+        double channelBandwidthHz;  // Bandwidth kept by channel filter
+        double quadRate;            // Target discriminator rate in Hz
+        double audioRate;           // Target audio rate in Hz
+        double deviationHz;         // Peak deviation, maps to audio +-1
+        double deemphasisUs;        // 75 in Americas, 50 elsewhere
+        size_t channelTaps;         // Channel filter length
+        size_t audioTaps;           // Audio filter length
+        size_t queueDepth;          // Chunks queued between stages
+
+        Config() :
+            sampleRate(2400000),
+            offsetHz(0),
+            channelBandwidthHz(200000),
+            quadRate(240000),
+            audioRate(48000),
+            deviationHz(75000),
+            deemphasisUs(75),
+            channelTaps(128),
+            audioTaps(64),
+            queueDepth(4) {}
+    };
+
+    /**
+     * @brief CPU use of one pipeline stage
+     */
+    struct StageStats {
+        double cpuSeconds;          // Thread CPU time
+        double utilization;         // CPU time over wall time since start, 1.0 is one core
+        unsigned long long chunks;  // Chunks processed
+    };
+
+    struct Stats {
+        StageStats channel;
+        StageStats discriminator;
+        StageStats audio;
+        double lastLatencyMs;       // RX refill to audio out, last chunk
+        double maxLatencyMs;        // RX refill to audio out, worst chunk
+        unsigned long long audioSamples;
+    };
+
+    typedef function<void(const AudioChunk&)> AudioCallback;
+
+    /**
+     * @brief Starts stage threads
+     *
+     * A stopped station can't be started again, create a new one.
+     *
+     */
+    void start()
+    {
+        if(running || stopped) {
+            return;
+        }
+        running = true;
+        startTime = chrono::steady_clock::now();
+
+        channelThread = thread(&FmStation::channelStage, this);
+        discriminatorThread = thread(&FmStation::discriminatorStage, this);
+        audioThread = thread(&FmStation::audioStage, this);
+    }
+
+    /**
+     * @brief Stops stage threads
+     *
+     * Input consumer is closed, so the stream keeps running without this
+     * station even with BLOCK policy. No more blocks are taken from input,
+     * chunks already passed between stages are still demodulated.
+     *
+     */
+    void stop()
+    {
+        if(!running) {
+            return;
+        }
+        running = false;
+        stopped = true;
+
+        // streaming thread may be waiting for room in our queue
+        input->close();
+        channelThread.join();
+        iqQueue.close();
+        discriminatorThread.join();
+        phaseQueue.close();
+        audioThread.join();
+    }
+
+    /**
+     * @brief Get per stage CPU use and latency
+     *
+     * @return Stats Snapshot of counters
+     */
+    Stats getStats() const
+    {
+        double wall = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+        Stats ret;
+        ret.channel = stageStats(channelCounters, wall);
+        ret.discriminator = stageStats(discriminatorCounters, wall);
+        ret.audio = stageStats(audioCounters, wall);
+        ret.lastLatencyMs = lastLatencyUs / 1000.0;
+        ret.maxLatencyMs = maxLatencyUs / 1000.0;
+        ret.audioSamples = audioSamples;
+        return ret;
+    }
+
+    /**
+     * @brief Get audio rate actually produced
+     *
+     * @return double Audio rate in Hz
+     */
+    double getAudioRate() const
+    {
+        return config.sampleRate / channelDecimation / audioDecimation;
+    }
+
+    /**
+     * @brief Get station name
+     *
+     * @return const string& Name from Config
+     */
+    const string& getName() const { return config.name; }
+
+    /**
+     * @brief Construct a new FmStation object
+     *
+     * @param config Station and filter settings
+     * @param input Fan-out consumer delivering RX blocks, use BLOCK policy for gapless audio
+     * @param onAudio Called from audio thread for every audio chunk
+     */
+    FmStation(const Config &config, shared_ptr<RxFanout::Consumer> input, AudioCallback onAudio) :
+        config(config),
+        input(input),
+        onAudio(onAudio),
+        channelDecimation(max(1L, lround(config.sampleRate / config.quadRate))),
+        audioDecimation(max(1L, lround(config.sampleRate / channelDecimation / config.audioRate))),
+        iqQueue(config.queueDepth),
+        phaseQueue(config.queueDepth),
+        running(false),
+        stopped(false),
+        lastLatencyUs(0),
+        maxLatencyUs(0),
+        audioSamples(0)
+    {
+        double quadRate = config.sampleRate / channelDecimation;
+
+        vector<float> channelTaps = designLowpass(config.channelTaps, config.channelBandwidthHz / 2, config.sampleRate);
+        channelFilterI.reset(new FirDecimator(channelTaps, channelDecimation));
+        channelFilterQ.reset(new FirDecimator(channelTaps, channelDecimation));
+
+        // audio band ends at 15 kHz, pilot and stereo subcarrier are cut off
+        vector<float> audioTaps = designLowpass(config.audioTaps, 15000, quadRate);
+        audioFilter.reset(new FirDecimator(audioTaps, audioDecimation));
+
+        deemphasisAlpha = 1.0f - exp(-1.0 / (quadRate * config.deemphasisUs * 1e-6));
+        discriminatorGain = quadRate / (2 * M_PI * config.deviationHz);
+
+        // oscillator table for one segment, see mix()
+        complex<double> step = polar(1.0, -2 * M_PI * config.offsetHz / config.sampleRate);
+        complex<double> p(1, 0);
+        for(size_t i = 0; i < NCO_SEGMENT; i++) {
+            ncoTableI[i] = p.real();
+            ncoTableQ[i] = p.imag();
+            p *= step;
+        }
+        ncoSegmentStep = p;
+        ncoPhase = complex<double>(1, 0);
+    }
+
+    ~FmStation()
+    {
+        stop();
+    }
+
+private:
+    FmStation(const FmStation&);
+    FmStation& operator=(const FmStation&);
+
+    static const size_t NCO_SEGMENT = 256;
+
+    struct IqChunk {
+        vector<float> i;
+        vector<float> q;
+        chrono::system_clock::time_point timestamp;
+    };
+
+    struct PhaseChunk {
+        vector<float> samples;
+        chrono::system_clock::time_point timestamp;
+    };
+
+    struct StageCounters {
+        atomic<long long> cpuNs;
+        atomic<unsigned long long> chunks;
+
+        StageCounters() :
+            cpuNs(0),
+            chunks(0) {}
+    };
+
+    static long long threadCpuNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    static StageStats stageStats(const StageCounters &counters, double wallSeconds)
+    {
+        StageStats ret;
+        ret.cpuSeconds = counters.cpuNs / 1e9;
+        ret.utilization = wallSeconds > 0 ? ret.cpuSeconds / wallSeconds : 0;
+        ret.chunks = counters.chunks;
+        return ret;
+    }
+
+    static void account(StageCounters &counters, long long &cpuMark)
+    {
+        long long now = threadCpuNs();
+        counters.cpuNs += now - cpuMark;
+        counters.chunks++;
+        cpuMark = now;
+    }
+
+    /**
+     * @brief Shifts station to 0 Hz, chain 0 only
+     *
+     * Oscillator is the table for one segment rotated by the running
+     * phase, so the inner loop has no loop carried dependency.
+     */
+    void mix(const RxBlock &block, vector<float> &outI, vector<float> &outQ)
+    {
+        size_t count = block.sampleCount();
+        size_t stride = 2 * block.channels;
+        const int16_t* in = block.samples.data();
+        const float scale = 1.0f / 2048.0f;
+        float segI[NCO_SEGMENT];
+        float segQ[NCO_SEGMENT];
+
+        outI.resize(count);
+        outQ.resize(count);
+
+        for(size_t base = 0; base < count; base += NCO_SEGMENT) {
+            size_t n = min(count - base, static_cast<size_t>(NCO_SEGMENT));
+            float pI = ncoPhase.real();
+            float pQ = ncoPhase.imag();
+            for(size_t k = 0; k < n; k++) {
+                segI[k] = (pI * ncoTableI[k] - pQ * ncoTableQ[k]) * scale;
+                segQ[k] = (pI * ncoTableQ[k] + pQ * ncoTableI[k]) * scale;
+            }
+            for(size_t k = 0; k < n; k++) {
+                float xi = in[stride * (base + k)];
+                float xq = in[stride * (base + k) + 1];
+                outI[base + k] = xi * segI[k] - xq * segQ[k];
+                outQ[base + k] = xi * segQ[k] + xq * segI[k];
+            }
+
+            if(NCO_SEGMENT == n) {
+                ncoPhase *= ncoSegmentStep;
+            }
+            else {
+                ncoPhase *= polar(1.0, -2 * M_PI * config.offsetHz * n / config.sampleRate);
+            }
+        }
+        // keep oscillator on unit circle
+        ncoPhase /= abs(ncoPhase);
+    }
+
+    void channelStage()
+    {
+        long long cpuMark = threadCpuNs();
+        vector<float> mixedI;
+        vector<float> mixedQ;
+        RxBlockPtr block;
+
+        while(running) {
+            RxFanout::PopResult result = input->pop(block, 100);
+            if(RxFanout::CLOSED == result) {
+                break;
+            }
+            if(RxFanout::POPPED != result) {
+                continue;
+            }
+
+            mix(*block, mixedI, mixedQ);
+
+            IqChunk chunk;
+            chunk.timestamp = block->timestamp;
+            channelFilterI->process(mixedI.data(), mixedI.size(), chunk.i);
+            channelFilterQ->process(mixedQ.data(), mixedQ.size(), chunk.q);
+            block.reset();
+
+            account(channelCounters, cpuMark);
+            if(!iqQueue.push(chunk)) {
+                break;
+            }
+        }
+    }
+
+    void discriminatorStage()
+    {
+        long long cpuMark = threadCpuNs();
+        vector<float> re;
+        vector<float> im;
+        float prevI = 0;
+        float prevQ = 0;
+        IqChunk chunk;
+
+        while(iqQueue.pop(chunk)) {
+            size_t n = chunk.i.size();
+            re.resize(n);
+            im.resize(n);
+
+            if(0 == n) {
+                continue;
+            }
+
+            // x[n] * conj(x[n-1]), its angle is the instantaneous frequency
+            const float* ci = chunk.i.data();
+            const float* cq = chunk.q.data();
+            re[0] = ci[0] * prevI + cq[0] * prevQ;
+            im[0] = cq[0] * prevI - ci[0] * prevQ;
+            for(size_t k = 1; k < n; k++) {
+                re[k] = ci[k] * ci[k - 1] + cq[k] * cq[k - 1];
+                im[k] = cq[k] * ci[k - 1] - ci[k] * cq[k - 1];
+            }
+            prevI = ci[n - 1];
+            prevQ = cq[n - 1];
+
+            PhaseChunk out;
+            out.timestamp = chunk.timestamp;
+            out.samples.resize(n);
+            fastAtan2(im.data(), re.data(), out.samples.data(), n);
+            for(size_t k = 0; k < n; k++) {
+                out.samples[k] *= discriminatorGain;
+            }
+
+            account(discriminatorCounters, cpuMark);
+            if(!phaseQueue.push(out)) {
+                break;
+            }
+        }
+    }
+
+    void audioStage()
+    {
+        long long cpuMark = threadCpuNs();
+        float deemphasized = 0;
+        PhaseChunk chunk;
+        AudioChunk audio;
+
+        while(phaseQueue.pop(chunk)) {
+            for(size_t k = 0; k < chunk.samples.size(); k++) {
+                deemphasized += deemphasisAlpha * (chunk.samples[k] - deemphasized);
+                chunk.samples[k] = deemphasized;
+            }
+
+            audio.samples.clear();
+            audio.timestamp = chunk.timestamp;
+            audioFilter->process(chunk.samples.data(), chunk.samples.size(), audio.samples);
+
+            if(onAudio) {
+                onAudio(audio);
+            }
+
+            long long latencyUs = chrono::duration_cast<chrono::microseconds>(
+                chrono::system_clock::now() - chunk.timestamp).count();
+            lastLatencyUs = latencyUs;
+            if(latencyUs > maxLatencyUs) {
+                maxLatencyUs = latencyUs;
+            }
+            audioSamples += audio.samples.size();
+            account(audioCounters, cpuMark);
+        }
+    }
+
+    Config config;
+    shared_ptr<RxFanout::Consumer> input;
+    AudioCallback onAudio;
+
+    long channelDecimation;
+    long audioDecimation;
+    unique_ptr<FirDecimator> channelFilterI;
+    unique_ptr<FirDecimator> channelFilterQ;
+    unique_ptr<FirDecimator> audioFilter;
+    float deemphasisAlpha;
+    float discriminatorGain;
+
+    float ncoTableI[NCO_SEGMENT];
+    float ncoTableQ[NCO_SEGMENT];
+    complex<double> ncoSegmentStep;
+    complex<double> ncoPhase;
+
+    BoundedQueue<IqChunk> iqQueue;
+    BoundedQueue<PhaseChunk> phaseQueue;
+
+    atomic<bool> running;
+    bool stopped;
+    chrono::steady_clock::time_point startTime;
+    thread channelThread;
+    thread discriminatorThread;
+    thread audioThread;
+
+    StageCounters channelCounters;
+    StageCounters discriminatorCounters;
+    StageCounters audioCounters;
+    atomic<long long> lastLatencyUs;
+    atomic<long long> maxLatencyUs;
+    atomic<unsigned long long> audioSamples;
+};
+
+#endif // FMDEMOD_H
@@ -0,0 +1,142 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * @brief Bounded lock free queue, any number of producers and consumers
+ *
+ * Every cell carries a sequence number telling whether it is free for
+ * the producer or filled for the consumer at a given position, so push
+ * and pop only contend on one position counter each and never wait.
+ */
+template<typename T>
+class LockFreeQueue {
+public:
+    /**
+     * @brief Construct a new queue
+     *
+     * @param capacity Maximum number of queued items, rounded up to power of 2
+     */
+    explicit LockFreeQueue(size_t capacity) :
+        enqueuePos(0),
+        dequeuePos(0)
+    {
+        size_t size = 2;
+        while(size < capacity) {
+            size *= 2;
+        }
+        mask = size - 1;
+
+        cells.reset(new Cell[size]);
+        for(size_t i = 0; i < size; i++) {
+            cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Adds item, never blocks
+     *
+     * @param item Item to add
+     * @return true Item was queued
+     * @return false Queue is full
+     */
+    bool push(const T &item)
+    {
+        Cell* cell;
+        size_t pos = enqueuePos.load(memory_order_relaxed);
+
+        for(;;) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+            if(0 == diff) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(diff < 0) {
+                return false;
+            }
+            else {
+                pos = enqueuePos.load(memory_order_relaxed);
+            }
+        }
+
+        cell->data = item;
+        cell->sequence.store(pos + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Takes oldest item, never blocks
+     *
+     * @param item Store item to
+     * @return true Item was taken
+     * @return false Queue is empty
+     */
+    bool pop(T &item)
+    {
+        Cell* cell;
+        size_t pos = dequeuePos.load(memory_order_relaxed);
+
+        for(;;) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+            if(0 == diff) {
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if(diff < 0) {
+                return false;
+            }
+            else {
+                pos = dequeuePos.load(memory_order_relaxed);
+            }
+        }
+
+        item = cell->data;
+        cell->sequence.store(pos + mask + 1, memory_order_release);
+        return true;
+    }
+
+private:
+    LockFreeQueue(const LockFreeQueue&);
+    LockFreeQueue& operator=(const LockFreeQueue&);
+
+    struct Cell {
+        atomic<size_t> sequence;
+        T data;
+    };
+
+    unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    // producers and consumer positions on separate cache lines
+    alignas(64) atomic<size_t> enqueuePos;
+    alignas(64) atomic<size_t> dequeuePos;
+};
+
+#endif // LOCKFREEQUEUE_H
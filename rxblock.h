@@ -0,0 +1,156 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef RXBLOCK_H
+#define RXBLOCK_H
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Block of RX samples copied out of one iio buffer refill
+ *
+ * Blocks are immutable once handed to consumers, so a single block
+ * can be shared between any number of readers without copying.
+ */
+struct RxBlock {
+    unsigned long long sequence;    // Block counter since stream start
+    unsigned long long firstSample; // Stream index of first I/Q sample
+    chrono::system_clock::time_point timestamp; // Time refill completed, i.e. end of block
+    unsigned int channels;          // Number of RF chains interleaved in samples
+    vector<int16_t> samples;        // Raw samples, I0 Q0 [I1 Q1] per sample time
+
+    /**
+     * @brief Number of I/Q samples per chain in block
+     *
+     * @return size_t Sample count
+     */
+    size_t sampleCount() const { return samples.size() / (2 * channels); }
+
+    RxBlock() :
+        sequence(0),
+        firstSample(0),
+        channels(1) {}
+};
+
+typedef shared_ptr<const RxBlock> RxBlockPtr;
+typedef function<void(const RxBlockPtr&)> RxCallback;
+
+/**
+ * @brief Samples lost while RX stream was recovering from connection loss
+ *
+ * The first block after the gap starts at firstSample + lostSamples, so
+ * sample indices keep following wall clock time across the outage.
+ */
+struct RxGap {
+    unsigned long long firstSample; // Stream index where gap starts
+    unsigned long long lostSamples; // Estimated from outage time and sampling rate
+    double outageMs;                // Time from last good refill to stream resumed
+    unsigned int attempts;          // Reconnect attempts needed
+
+    RxGap() :
+        firstSample(0),
+        lostSamples(0),
+        outageMs(0),
+        attempts(0) {}
+};
+
+typedef function<void(const RxGap&)> RxGapCallback;
+
+/**
+ * @brief Recycles RX blocks so sample storage is reused
+ *
+ * Blocks handed out by acquire() return to the pool when the last
+ * consumer drops its reference. Blocks outliving the pool are freed.
+ * Only the small shared_ptr control block is allocated per acquire().
+ */
+class RxBlockPool : public enable_shared_from_this<RxBlockPool> {
+public:
+    /**
+     * @brief Creates a new pool
+     *
+     * @param maxFree Maximum number of idle blocks kept for reuse
+     * @return shared_ptr<RxBlockPool> Pool
+     */
+    static shared_ptr<RxBlockPool> create(size_t maxFree)
+    {
+        return shared_ptr<RxBlockPool>(new RxBlockPool(maxFree));
+    }
+
+    /**
+     * @brief Get an idle block or allocate a new one
+     *
+     * @return shared_ptr<RxBlock> Block to fill, contents are unspecified
+     */
+    shared_ptr<RxBlock> acquire()
+    {
+        RxBlock* block = nullptr;
+        {
+            lock_guard<mutex> lock(mtx);
+            if(!freeBlocks.empty()) {
+                block = freeBlocks.back();
+                freeBlocks.pop_back();
+            }
+        }
+        if(nullptr == block) {
+            block = new RxBlock();
+        }
+
+        weak_ptr<RxBlockPool> pool(shared_from_this());
+        return shared_ptr<RxBlock>(block, [pool](RxBlock* b) {
+            shared_ptr<RxBlockPool> owner = pool.lock();
+            if(owner) {
+                owner->release(b);
+            }
+            else {
+                delete b;
+            }
+        });
+    }
+
+    ~RxBlockPool()
+    {
+        for(size_t i = 0; i < freeBlocks.size(); i++) {
+            delete freeBlocks[i];
+        }
+    }
+
+private:
+    RxBlockPool(size_t maxFree) :
+        maxFree(maxFree) {}
+
+    void release(RxBlock* block)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            if(freeBlocks.size() < maxFree) {
+                freeBlocks.push_back(block);
+                return;
+            }
+        }
+        delete block;
+    }
+
+    mutex mtx;
+    vector<RxBlock*> freeBlocks;
+    size_t maxFree;
+};
+
+#endif // RXBLOCK_H
@@ -0,0 +1,343 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef RXFANOUT_H
+#define RXFANOUT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "rxblock.h"
+
+using namespace std;
+
+/**
+ * @brief Shares RX blocks between several consumers
+ *
+ * Each consumer owns a bounded queue of block references, blocks itself
+ * are never copied. What happens when a queue is full is decided per
+ * consumer, so a slow display can drop blocks while a recorder still
+ * gets every one of them.
+ */
+class RxFanout {
+public:
+    /**
+     * @brief What to do when consumer queue is full
+     */
+    enum Policy {
+        BLOCK,          // Producer waits for consumer, nothing is lost
+        DROP_OLDEST,    // Oldest queued block is discarded
+        DROP_NEWEST,    // Incoming block is discarded
+        EVERY_NTH       // Only every Nth block is queued, drops newest when full
+    };
+
+    /**
+     * @brief Outcome of Consumer::pop
+     */
+    enum PopResult {
+        POPPED,         // Block was taken
+        TIMED_OUT,      // Nothing queued yet, more blocks may follow
+        CLOSED          // Hub closed or removed consumer and queue is drained
+    };
+
+    /**
+     * @brief Per consumer counters
+     */
+    struct Stats {
+        unsigned long long delivered;   // Blocks taken by consumer
+        unsigned long long dropped;     // Blocks lost due to full queue
+        unsigned long long skipped;     // Blocks not offered due to EVERY_NTH
+        unsigned long long lagBlocks;   // Newest pushed block minus last taken block
+        unsigned long long maxLagBlocks;// Highest lagBlocks seen
+        size_t queued;                  // Blocks currently waiting in queue
+        double blockedMs;               // Time producer spent waiting (BLOCK only)
+    };
+
+    class Consumer {
+    public:
+        /**
+         * @brief Takes next block from queue
+         *
+         * @param block Store block to
+         * @param timeoutMs Maximum time to wait for a block
+         * @return PopResult POPPED, TIMED_OUT or CLOSED once no more blocks will come
+         */
+        PopResult pop(RxBlockPtr &block, unsigned int timeoutMs)
+        {
+            unique_lock<mutex> lock(mtx);
+            if(!notEmpty.wait_for(lock, chrono::milliseconds(timeoutMs),
+                    [this] { return !queue.empty() || closed; })) {
+                return TIMED_OUT;
+            }
+            if(queue.empty()) {
+                return CLOSED;
+            }
+
+            block = queue.front();
+            queue.pop_front();
+            stats.delivered++;
+            lastTaken = block->sequence;
+            hasTaken = true;
+            updateLag();
+            lock.unlock();
+
+            notFull.notify_one();
+            return POPPED;
+        }
+
+        /**
+         * @brief Check whether hub closed or removed consumer
+         *
+         * @return true No more blocks will be queued
+         * @return false Consumer is live
+         */
+        bool isClosed()
+        {
+            lock_guard<mutex> lock(mtx);
+            return closed;
+        }
+
+        /**
+         * @brief Get snapshot of consumer counters
+         *
+         * @return Stats Counters
+         */
+        Stats getStats()
+        {
+            lock_guard<mutex> lock(mtx);
+            Stats ret = stats;
+            ret.queued = queue.size();
+            return ret;
+        }
+
+        /**
+         * @brief Get consumer name
+         *
+         * @return const string& Name given on registration
+         */
+        const string& getName() const { return name; }
+
+        /**
+         * @brief Stops taking blocks, producer no longer waits for this consumer
+         *
+         * Called by the hub on close and removal, consumers call it when they
+         * quit while the stream goes on. Queued blocks can still be popped.
+         */
+        void close()
+        {
+            {
+                lock_guard<mutex> lock(mtx);
+                closed = true;
+            }
+            notEmpty.notify_all();
+            notFull.notify_all();
+        }
+
+        Consumer(const string &name, Policy policy, size_t depth, unsigned int everyN) :
+            name(name),
+            policy(policy),
+            depth(depth > 0 ? depth : 1),
+            everyN(everyN > 0 ? everyN : 1),
+            offered(0),
+            lastPushed(0),
+            lastTaken(0),
+            hasTaken(false),
+            closed(false)
+        {
+            stats = Stats();
+        }
+
+    private:
+        friend class RxFanout;
+
+        /**
+         * @brief Queues block according to policy, called by producer
+         *
+         * @param block Block to queue
+         */
+        void offer(const RxBlockPtr &block)
+        {
+            unique_lock<mutex> lock(mtx);
+            if(closed) {
+                return;
+            }
+            lastPushed = block->sequence;
+
+            if(EVERY_NTH == policy && (offered++ % everyN) != 0) {
+                stats.skipped++;
+                updateLag();
+                return;
+            }
+
+            if(queue.size() >= depth) {
+                switch(policy) {
+                case BLOCK: {
+                    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+                    notFull.wait(lock, [this] { return queue.size() < depth || closed; });
+                    stats.blockedMs += chrono::duration<double, milli>(
+                        chrono::steady_clock::now() - begin).count();
+                    if(closed) {
+                        return;
+                    }
+                    break;
+                }
+                case DROP_OLDEST:
+                    queue.pop_front();
+                    stats.dropped++;
+                    break;
+                case DROP_NEWEST:
+                case EVERY_NTH:
+                    stats.dropped++;
+                    updateLag();
+                    return;
+                }
+            }
+
+            queue.push_back(block);
+            updateLag();
+            lock.unlock();
+
+            notEmpty.notify_one();
+        }
+
+        void updateLag()
+        {
+            // before first pop consumer lags behind everything pushed so far
+            stats.lagBlocks = hasTaken ? lastPushed - lastTaken : lastPushed + 1;
+            if(stats.lagBlocks > stats.maxLagBlocks) {
+                stats.maxLagBlocks = stats.lagBlocks;
+            }
+        }
+
+        string name;
+        Policy policy;
+        size_t depth;
+        unsigned int everyN;
+        unsigned long long offered;
+        unsigned long long lastPushed;
+        unsigned long long lastTaken;
+        bool hasTaken;
+        bool closed;
+
+        mutex mtx;
+        condition_variable notEmpty;
+        condition_variable notFull;
+        deque<RxBlockPtr> queue;
+        Stats stats;
+    }; // Consumer Class
+
+    /**
+     * @brief Registers new consumer
+     *
+     * Consumers added after close start out closed.
+     *
+     * @param name Consumer name, used for reporting only
+     * @param policy What to do when consumer queue is full
+     * @param depth Maximum number of queued blocks
+     * @param everyN Queue only every Nth block, used with EVERY_NTH
+     * @return shared_ptr<Consumer> Consumer to pop blocks from
+     */
+    shared_ptr<Consumer> addConsumer(const string &name, Policy policy, size_t depth, unsigned int everyN = 1)
+    {
+        shared_ptr<Consumer> consumer(new Consumer(name, policy, depth, everyN));
+
+        lock_guard<mutex> lock(mtx);
+        if(closed) {
+            consumer->close();
+        }
+        else {
+            consumers.push_back(consumer);
+        }
+        return consumer;
+    }
+
+    /**
+     * @brief Unregisters consumer, producer blocked on it is released
+     *
+     * @param consumer Consumer to remove
+     */
+    void removeConsumer(const shared_ptr<Consumer> &consumer)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            for(size_t i = 0; i < consumers.size(); i++) {
+                if(consumers[i] == consumer) {
+                    consumers.erase(consumers.begin() + i);
+                    break;
+                }
+            }
+        }
+        consumer->close();
+    }
+
+    /**
+     * @brief Offers block to all consumers, called from streaming thread
+     *
+     * @param block Block to share
+     */
+    void push(const RxBlockPtr &block)
+    {
+        vector<shared_ptr<Consumer> > snapshot;
+        {
+            lock_guard<mutex> lock(mtx);
+            snapshot = consumers;
+        }
+
+        for(size_t i = 0; i < snapshot.size(); i++) {
+            snapshot[i]->offer(block);
+        }
+    }
+
+    /**
+     * @brief Get callback pushing blocks into hub
+     *
+     * @return RxCallback Callback for AD9361::startRxStream
+     */
+    RxCallback callback()
+    {
+        return [this](const RxBlockPtr &block) { push(block); };
+    }
+
+    /**
+     * @brief Closes all consumers, pending blocks can still be popped
+     *
+     */
+    void close()
+    {
+        vector<shared_ptr<Consumer> > snapshot;
+        {
+            lock_guard<mutex> lock(mtx);
+            closed = true;
+            snapshot = consumers;
+        }
+
+        for(size_t i = 0; i < snapshot.size(); i++) {
+            snapshot[i]->close();
+        }
+    }
+
+    RxFanout() :
+        closed(false) {}
+
+private:
+    mutex mtx;
+    vector<shared_ptr<Consumer> > consumers;
+    bool closed;
+};
+
+#endif // RXFANOUT_H
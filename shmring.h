@@ -0,0 +1,471 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "rxblock.h"
+
+using namespace std;
+
+/*
+ * Shared memory layout:
+ *
+ *   ShmRingHeader | slot 0 | slot 1 | ... | slot N-1
+ *   slot:           ShmSlotHeader | slotBytes of raw I/Q samples
+ *
+ * Slot state is a seqlock: odd while publisher writes ring position r into
+ * it (2r+1), even once complete (2r+2). Subscribers check it before and
+ * after copying, so an overwritten slot is detected instead of returned.
+ */
+
+#define SHMRING_MAGIC   0x51495244u // "DRIQ"
+#define SHMRING_VERSION 2u
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared ring needs lock free 64 bit atomics");
+
+struct ShmRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;             // Number of slots in ring
+    uint32_t slotBytes;             // Sample payload capacity of one slot
+    atomic<int64_t> sampleRate;     // Current sampling rate in Hz
+    atomic<int64_t> loHz;           // Current LO frequency in Hz
+    atomic<uint64_t> writeSeq;      // Number of blocks published so far
+    atomic<uint32_t> futexWord;     // Bumped and woken on every publish
+    atomic<uint32_t> closed;        // Set when publisher goes away
+};
+
+struct ShmSlotHeader {
+    atomic<uint64_t> state;         // Seqlock, see layout description
+    uint64_t blockSequence;         // RxBlock::sequence
+    uint64_t firstSample;           // RxBlock::firstSample
+    int64_t sampleRate;             // Sampling rate when block was published
+    int64_t loHz;                   // LO frequency when block was published
+    uint32_t sampleCount;           // Number of I/Q samples per chain in slot
+    uint32_t channels;              // Number of RF chains interleaved in slot
+};
+
+/**
+ * @brief Block read from shared memory ring
+ */
+struct ShmRingBlock {
+    unsigned long long blockSequence;   // Sequence number given by radio process
+    unsigned long long firstSample;     // Stream index of first I/Q sample
+    long long sampleRate;               // Sampling rate in Hz
+    long long loHz;                     // LO frequency in Hz
+    unsigned long long lost;            // Blocks skipped because subscriber was lapped
+    unsigned int channels;              // Number of RF chains interleaved in samples
+    vector<int16_t> samples;            // Raw samples, I0 Q0 [I1 Q1] per sample time
+};
+
+/**
+ * @brief Size of one slot including its header, keeps slots cache line aligned
+ *
+ * @param slotBytes Sample payload capacity
+ * @return size_t Slot stride in bytes
+ */
+static inline size_t shmRingSlotStride(size_t slotBytes)
+{
+    return (sizeof(ShmSlotHeader) + slotBytes + 63) & ~static_cast<size_t>(63);
+}
+
+/**
+ * @brief Offset of first slot from start of mapping
+ *
+ * @return size_t Offset in bytes
+ */
+static inline size_t shmRingSlotsOffset()
+{
+    return (sizeof(ShmRingHeader) + 63) & ~static_cast<size_t>(63);
+}
+
+/**
+ * @brief Writes RX blocks into a POSIX shared memory ring
+ *
+ * Single writer, never waits for subscribers. Slow subscribers get lapped
+ * and notice it on their next read.
+ */
+class ShmRingPublisher {
+public:
+    /**
+     * @brief Creates shared memory object and maps it
+     *
+     * @param name Shared memory name, e.g. "/ad9361_rx"
+     * @param slotCount Number of blocks kept in ring
+     * @param slotBytes Maximum size of one block in bytes
+     * @return true Ring is ready to publish
+     * @return false Shared memory couldn't be created or mapped
+     */
+    bool open(const string &name, unsigned int slotCount, size_t slotBytes)
+    {
+        close();
+        if(0 == slotCount || 0 == slotBytes || slotBytes > UINT32_MAX) {
+            return false;
+        }
+
+        size_t size = shmRingSlotsOffset() + slotCount * shmRingSlotStride(slotBytes);
+
+        // stale object may still be mapped by subscribers, never resize it
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(fd < 0) {
+            return false;
+        }
+        if(ftruncate(fd, size) < 0) {
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(MAP_FAILED == mem) {
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        base = static_cast<char*>(mem);
+        mapSize = size;
+        shmName = name;
+        stride = shmRingSlotStride(slotBytes);
+
+        // fresh object is zero filled, atomics are valid as zero
+        header = reinterpret_cast<ShmRingHeader*>(base);
+        header->slotCount = slotCount;
+        header->slotBytes = slotBytes;
+        header->version = SHMRING_VERSION;
+        // magic last, subscribers refuse the ring until it is set
+        atomic_thread_fence(memory_order_release);
+        header->magic = SHMRING_MAGIC;
+        return true;
+    }
+
+    /**
+     * @brief Updates stream parameters stored with next published blocks
+     *
+     * @param sampleRate Sampling rate in Hz
+     * @param loHz LO frequency in Hz
+     */
+    void setStreamInfo(long long sampleRate, long long loHz)
+    {
+        if(nullptr == header) {
+            return;
+        }
+        header->sampleRate.store(sampleRate, memory_order_relaxed);
+        header->loHz.store(loHz, memory_order_relaxed);
+    }
+
+    /**
+     * @brief Copies block into next slot and wakes subscribers
+     *
+     * @param block Block to publish
+     * @return true Block was published
+     * @return false Ring not open or block larger than slot
+     */
+    bool publish(const RxBlock &block)
+    {
+        size_t bytes = block.samples.size() * sizeof(int16_t);
+        if(nullptr == header || bytes > header->slotBytes) {
+            return false;
+        }
+
+        uint64_t pos = header->writeSeq.load(memory_order_relaxed);
+        ShmSlotHeader* slot = reinterpret_cast<ShmSlotHeader*>(
+            base + shmRingSlotsOffset() + (pos % header->slotCount) * stride);
+
+        slot->state.store(2 * pos + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        slot->blockSequence = block.sequence;
+        slot->firstSample = block.firstSample;
+        slot->sampleRate = header->sampleRate.load(memory_order_relaxed);
+        slot->loHz = header->loHz.load(memory_order_relaxed);
+        slot->sampleCount = block.sampleCount();
+        slot->channels = block.channels;
+        memcpy(reinterpret_cast<char*>(slot) + sizeof(ShmSlotHeader), block.samples.data(), bytes);
+
+        slot->state.store(2 * pos + 2, memory_order_release);
+        header->writeSeq.store(pos + 1, memory_order_release);
+        wake();
+        return true;
+    }
+
+    /**
+     * @brief Marks ring closed, unmaps and removes shared memory object
+     *
+     */
+    void close()
+    {
+        if(nullptr == header) {
+            return;
+        }
+        header->closed.store(1, memory_order_release);
+        wake();
+
+        // subscribers keep their mapping until they unmap it themselves
+        munmap(base, mapSize);
+        shm_unlink(shmName.c_str());
+        base = nullptr;
+        header = nullptr;
+    }
+
+    ShmRingPublisher() :
+        base(nullptr),
+        header(nullptr),
+        mapSize(0),
+        stride(0) {}
+
+    ~ShmRingPublisher()
+    {
+        close();
+    }
+
+private:
+    ShmRingPublisher(const ShmRingPublisher&);
+    ShmRingPublisher& operator=(const ShmRingPublisher&);
+
+    void wake()
+    {
+        header->futexWord.fetch_add(1, memory_order_release);
+        syscall(SYS_futex, &header->futexWord, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+    }
+
+    char* base;
+    ShmRingHeader* header;
+    size_t mapSize;
+    size_t stride;
+    string shmName;
+};
+
+/**
+ * @brief Reads RX blocks from a ring created by ShmRingPublisher
+ *
+ * Maps the ring read-only and does not depend on libiio, so any number
+ * of processes can follow the stream owned by the radio process.
+ */
+class ShmRingSubscriber {
+public:
+    /**
+     * @brief Maps existing ring, reading starts at newest published block
+     *
+     * @param name Shared memory name used by publisher
+     * @return true Ring mapped
+     * @return false Ring doesn't exist or isn't a valid ring
+     */
+    bool open(const string &name)
+    {
+        close();
+
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < shmRingSlotsOffset()) {
+            ::close(fd);
+            return false;
+        }
+        void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(MAP_FAILED == mem) {
+            return false;
+        }
+
+        base = static_cast<const char*>(mem);
+        mapSize = st.st_size;
+        header = reinterpret_cast<const ShmRingHeader*>(base);
+
+        if(header->magic != SHMRING_MAGIC || header->version != SHMRING_VERSION ||
+            0 == header->slotCount ||
+            mapSize < shmRingSlotsOffset() + header->slotCount * shmRingSlotStride(header->slotBytes)) {
+            close();
+            return false;
+        }
+        atomic_thread_fence(memory_order_acquire);
+
+        stride = shmRingSlotStride(header->slotBytes);
+        uint64_t written = header->writeSeq.load(memory_order_acquire);
+        readSeq = written > 0 ? written - 1 : 0;
+        lapCount = 0;
+        return true;
+    }
+
+    /**
+     * @brief Waits for next block and copies it out
+     *
+     * When the publisher overwrote blocks not yet read, reading continues
+     * at the newest block and block.lost tells how many were skipped.
+     *
+     * @param block Store block to
+     * @param timeoutMs Maximum time to wait for a block
+     * @return true Block was read
+     * @return false Timed out, ring closed or not open
+     */
+    bool read(ShmRingBlock &block, unsigned int timeoutMs)
+    {
+        if(nullptr == header) {
+            return false;
+        }
+        block.lost = 0;
+
+        for(;;) {
+            uint32_t futexVal = header->futexWord.load(memory_order_acquire);
+            uint64_t written = header->writeSeq.load(memory_order_acquire);
+
+            if(written <= readSeq) {
+                if(header->closed.load(memory_order_acquire)) {
+                    return false;
+                }
+                if(!wait(futexVal, timeoutMs)) {
+                    return false;
+                }
+                continue;
+            }
+
+            if(written - readSeq > header->slotCount) {
+                resync(block, written);
+                continue;
+            }
+
+            const ShmSlotHeader* slot = reinterpret_cast<const ShmSlotHeader*>(
+                base + shmRingSlotsOffset() + (readSeq % header->slotCount) * stride);
+
+            uint64_t expected = 2 * readSeq + 2;
+            if(slot->state.load(memory_order_acquire) != expected) {
+                resync(block, header->writeSeq.load(memory_order_acquire));
+                continue;
+            }
+
+            block.blockSequence = slot->blockSequence;
+            block.firstSample = slot->firstSample;
+            block.sampleRate = slot->sampleRate;
+            block.loHz = slot->loHz;
+            block.channels = slot->channels;
+            size_t values = static_cast<size_t>(slot->sampleCount) * 2 * block.channels;
+            if(values * sizeof(int16_t) > header->slotBytes) {
+                // torn header, state check below rejects it
+                values = 0;
+            }
+            block.samples.resize(values);
+            memcpy(block.samples.data(), reinterpret_cast<const char*>(slot) + sizeof(ShmSlotHeader),
+                values * sizeof(int16_t));
+
+            atomic_thread_fence(memory_order_acquire);
+            if(slot->state.load(memory_order_relaxed) != expected) {
+                // overwritten while copying
+                resync(block, header->writeSeq.load(memory_order_acquire));
+                continue;
+            }
+
+            readSeq++;
+            return true;
+        }
+    }
+
+    /**
+     * @brief Check whether publisher closed the ring
+     *
+     * @return true Publisher is gone, no more blocks will arrive
+     * @return false Ring is live
+     */
+    bool isClosed() const
+    {
+        return nullptr == header || header->closed.load(memory_order_acquire) != 0;
+    }
+
+    /**
+     * @brief Get number of times subscriber was lapped by publisher
+     *
+     * @return unsigned long long Lap count
+     */
+    unsigned long long getLapCount() const { return lapCount; }
+
+    /**
+     * @brief Unmaps ring
+     *
+     */
+    void close()
+    {
+        if(nullptr != base) {
+            munmap(const_cast<char*>(base), mapSize);
+        }
+        base = nullptr;
+        header = nullptr;
+    }
+
+    ShmRingSubscriber() :
+        base(nullptr),
+        header(nullptr),
+        mapSize(0),
+        stride(0),
+        readSeq(0),
+        lapCount(0) {}
+
+    ~ShmRingSubscriber()
+    {
+        close();
+    }
+
+private:
+    ShmRingSubscriber(const ShmRingSubscriber&);
+    ShmRingSubscriber& operator=(const ShmRingSubscriber&);
+
+    void resync(ShmRingBlock &block, uint64_t written)
+    {
+        // jump to newest block, anything older is about to be overwritten
+        uint64_t next = written > 0 ? written - 1 : 0;
+        if(next > readSeq) {
+            block.lost += next - readSeq;
+            readSeq = next;
+        }
+        else {
+            // slot being rewritten right now, skip it
+            block.lost++;
+            readSeq++;
+        }
+        lapCount++;
+    }
+
+    bool wait(uint32_t futexVal, unsigned int timeoutMs)
+    {
+        struct timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+        long ret = syscall(SYS_futex, &header->futexWord, FUTEX_WAIT, futexVal, &ts, nullptr, 0);
+        return 0 == ret || EINTR == errno || EAGAIN == errno;
+    }
+
+    const char* base;
+    const ShmRingHeader* header;
+    size_t mapSize;
+    size_t stride;
+    uint64_t readSeq;
+    unsigned long long lapCount;
+};
+
+#endif // SHMRING_H